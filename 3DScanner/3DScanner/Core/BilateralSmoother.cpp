@@ -0,0 +1,321 @@
+#include "BilateralSmoother.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BILATERAL_SSE 1
+#endif
+
+#ifdef BILATERAL_SSE
+//e^x for x <= 0, relative error around 1e-7
+static inline __m128 ExpNegative(__m128 x)
+{
+	x = _mm_max_ps(x, _mm_set1_ps(-87.0f));
+
+	//e^x = 2^i * 2^f with i the nearest integer of x / ln(2)
+	const __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+	const __m128i i = _mm_cvtps_epi32(t);
+	const __m128 f = _mm_mul_ps(_mm_sub_ps(t, _mm_cvtepi32_ps(i)), _mm_set1_ps(0.693147181f));
+
+	//Taylor series of e^f, |f| <= ln(2) / 2
+	__m128 p = _mm_set1_ps(1.0f / 720.0f);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f / 120.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f / 24.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f / 6.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.5f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+	const __m128i exponent = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+}
+
+static inline float Sum(__m128 v)
+{
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, v);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+#endif
+
+float BilateralSmoother::NeighborRadius(const NeighborCache& neighbors, unsigned int k, ThreadPool& pool) const
+{
+	const std::size_t count = position[0].size();
+	std::vector<float> chunkRadius(ThreadPool::ChunkCount(count, PARALLEL_GRAIN), 0);
+
+	pool.ParallelFor(count, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		float radius = 0;
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const std::uint32_t* list = neighbors.Neighbors(i);
+
+			for (unsigned int n = 1; n <= k; ++n)
+			{
+				const float dx = position[0][list[n]] - position[0][i];
+				const float dy = position[1][list[n]] - position[1][i];
+				const float dz = position[2][list[n]] - position[2][i];
+				radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+			}
+		}
+
+		chunkRadius[begin / PARALLEL_GRAIN] = radius;
+	});
+
+	const float maxRadius = chunkRadius.empty() ? 0 : *std::max_element(chunkRadius.begin(), chunkRadius.end());
+	return std::sqrt(maxRadius) * 0.95f;
+}
+
+float BilateralSmoother::Iterate(const NeighborCache& neighbors, unsigned int k, float radius, ThreadPool& pool)
+{
+	const std::size_t count = position[0].size();
+
+	const float radius2 = radius * radius;
+	const float iradius16 = -4.0f / radius2;
+	const float cosSigma = std::cos(sharpnessAngle / 180.0f * 3.1415926f);
+	const float sharpnessBandwidth = std::pow(std::max(1e-8f, 1 - cosSigma), 2.0f);
+	const float inverseBandwidth = 1.0f / sharpnessBandwidth;
+
+	std::vector<double> chunkMove(ThreadPool::ChunkCount(count, PARALLEL_GRAIN), 0);
+
+	pool.ParallelFor(count, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		double move = 0;
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			//The neighborhood CGAL uses is the k closest points, the point itself included
+			const std::uint32_t* list = neighbors.Neighbors(i);
+
+			const float q[3] = { position[0][i], position[1][i], position[2][i] };
+			const float qn[3] = { normal[0][i], normal[1][i], normal[2][i] };
+
+			float projectDistance = 0;
+			float weightSum = 0;
+			float normalSum[3] = { 0, 0, 0 };
+			unsigned int n = 0;
+
+#ifdef BILATERAL_SSE
+			const __m128 qx = _mm_set1_ps(q[0]);
+			const __m128 qy = _mm_set1_ps(q[1]);
+			const __m128 qz = _mm_set1_ps(q[2]);
+			const __m128 qnx = _mm_set1_ps(qn[0]);
+			const __m128 qny = _mm_set1_ps(qn[1]);
+			const __m128 qnz = _mm_set1_ps(qn[2]);
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 limit = _mm_set1_ps(radius2);
+			const __m128 distanceScale = _mm_set1_ps(iradius16);
+			const __m128 angleScale = _mm_set1_ps(inverseBandwidth);
+			const __m128 signBit = _mm_set1_ps(-0.0f);
+
+			__m128 projectSum4 = _mm_setzero_ps();
+			__m128 weightSum4 = _mm_setzero_ps();
+			__m128 normalSumX = _mm_setzero_ps();
+			__m128 normalSumY = _mm_setzero_ps();
+			__m128 normalSumZ = _mm_setzero_ps();
+
+			for (; n + 4 <= k; n += 4)
+			{
+				const std::uint32_t a = list[n], b = list[n + 1], c = list[n + 2], d = list[n + 3];
+
+				const __m128 dx = _mm_sub_ps(qx, _mm_set_ps(position[0][d], position[0][c], position[0][b], position[0][a]));
+				const __m128 dy = _mm_sub_ps(qy, _mm_set_ps(position[1][d], position[1][c], position[1][b], position[1][a]));
+				const __m128 dz = _mm_sub_ps(qz, _mm_set_ps(position[2][d], position[2][c], position[2][b], position[2][a]));
+				__m128 nx = _mm_set_ps(normal[0][d], normal[0][c], normal[0][b], normal[0][a]);
+				__m128 ny = _mm_set_ps(normal[1][d], normal[1][c], normal[1][b], normal[1][a]);
+				__m128 nz = _mm_set_ps(normal[2][d], normal[2][c], normal[2][b], normal[2][a]);
+
+				__m128 cosine = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qnx, nx), _mm_mul_ps(qny, ny)), _mm_mul_ps(qnz, nz));
+
+				if (!orientedNormals)
+				{
+					//Flip the neighbors facing away into the query's hemisphere
+					const __m128 flip = _mm_and_ps(_mm_cmplt_ps(cosine, _mm_setzero_ps()), signBit);
+					nx = _mm_xor_ps(nx, flip);
+					ny = _mm_xor_ps(ny, flip);
+					nz = _mm_xor_ps(nz, flip);
+					cosine = _mm_xor_ps(cosine, flip);
+				}
+
+				const __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				const __m128 angle = _mm_sub_ps(one, cosine);
+
+				//theta * psi as a single exponential
+				const __m128 exponent = _mm_sub_ps(_mm_mul_ps(distance2, distanceScale), _mm_mul_ps(_mm_mul_ps(angle, angle), angleScale));
+				const __m128 weight = _mm_and_ps(ExpNegative(exponent), _mm_cmplt_ps(distance2, limit));
+
+				const __m128 projected = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, nx), _mm_mul_ps(dy, ny)), _mm_mul_ps(dz, nz));
+
+				projectSum4 = _mm_add_ps(projectSum4, _mm_mul_ps(projected, weight));
+				weightSum4 = _mm_add_ps(weightSum4, weight);
+				normalSumX = _mm_add_ps(normalSumX, _mm_mul_ps(nx, weight));
+				normalSumY = _mm_add_ps(normalSumY, _mm_mul_ps(ny, weight));
+				normalSumZ = _mm_add_ps(normalSumZ, _mm_mul_ps(nz, weight));
+			}
+
+			projectDistance = Sum(projectSum4);
+			weightSum = Sum(weightSum4);
+			normalSum[0] = Sum(normalSumX);
+			normalSum[1] = Sum(normalSumY);
+			normalSum[2] = Sum(normalSumZ);
+#endif
+
+			for (; n < k; ++n)
+			{
+				const std::uint32_t j = list[n];
+
+				const float d[3] = { q[0] - position[0][j], q[1] - position[1][j], q[2] - position[2][j] };
+				float nn[3] = { normal[0][j], normal[1][j], normal[2][j] };
+
+				const float distance2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+				if (distance2 >= radius2)
+					continue;
+
+				float cosine = qn[0] * nn[0] + qn[1] * nn[1] + qn[2] * nn[2];
+
+				if (!orientedNormals && cosine < 0)
+				{
+					nn[0] = -nn[0];
+					nn[1] = -nn[1];
+					nn[2] = -nn[2];
+					cosine = -cosine;
+				}
+
+				const float angle = 1 - cosine;
+				const float weight = std::exp(distance2 * iradius16 - angle * angle * inverseBandwidth);
+
+				projectDistance += (d[0] * nn[0] + d[1] * nn[1] + d[2] * nn[2]) * weight;
+				weightSum += weight;
+				normalSum[0] += nn[0] * weight;
+				normalSum[1] += nn[1] * weight;
+				normalSum[2] += nn[2] * weight;
+			}
+
+			const float length = std::sqrt(normalSum[0] * normalSum[0] + normalSum[1] * normalSum[1] + normalSum[2] * normalSum[2]);
+
+			//No usable normals around this point, leave it where it is
+			if (weightSum <= 0 || length <= 0)
+			{
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					updatePosition[axis][i] = q[axis];
+					updateNormal[axis][i] = qn[axis];
+				}
+				continue;
+			}
+
+			const float offset = projectDistance / weightSum;
+			double moved = 0;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const float unit = normalSum[axis] / length;
+
+				updateNormal[axis][i] = unit;
+				updatePosition[axis][i] = q[axis] - unit * offset;
+
+				const double delta = static_cast<double>(unit) * offset;
+				moved += delta * delta;
+			}
+
+			move += moved;
+		}
+
+		chunkMove[begin / PARALLEL_GRAIN] = move;
+	});
+
+	double move = 0;
+	for (double chunk : chunkMove)
+		move += chunk;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		std::swap(position[axis], updatePosition[axis]);
+		std::swap(normal[axis], updateNormal[axis]);
+	}
+
+	return count > 0 ? static_cast<float>(move / count) : 0;
+}
+
+std::vector<float> BilateralSmoother::Smooth(std::vector<PointWithData>& points, const NeighborCache& neighbors, unsigned int k,
+	int iterations, float stopDisplacement, ThreadPool& pool,
+	const std::function<void(int, float)>& progress)
+{
+	std::vector<float> displacements;
+
+	const std::size_t count = points.size();
+	if (count == 0 || neighbors.Size() != count || neighbors.CachedK() < k || k < 2)
+		return displacements;
+
+	//Relative to the first point so float keeps the precision of the scan
+	const Point origin = std::get<0>(points[0]);
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		position[axis].resize(count);
+		normal[axis].resize(count);
+		updatePosition[axis].resize(count);
+		updateNormal[axis].resize(count);
+	}
+
+	pool.ParallelFor(count, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const Point& point = std::get<0>(points[i]);
+			const Vector& pointNormal = std::get<2>(points[i]);
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				position[axis][i] = static_cast<float>(point[axis] - origin[axis]);
+				normal[axis][i] = static_cast<float>(pointNormal[axis]);
+			}
+		}
+	});
+
+	for (int iteration = 0; iteration < iterations; ++iteration)
+	{
+		//Points move every pass, so the radius is updated like a fresh CGAL call would
+		const float radius = NeighborRadius(neighbors, k, pool);
+		if (radius <= 0)
+			break;
+
+		const float displacement = std::sqrt(Iterate(neighbors, k, radius, pool));
+		displacements.push_back(displacement);
+
+		if (progress)
+			progress(iteration + 1, displacement);
+
+		if (displacement < stopDisplacement)
+			break;
+	}
+
+	//Nothing ran, keep the double precision positions
+	if (displacements.empty())
+		return displacements;
+
+	pool.ParallelFor(count, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			std::get<0>(points[i]) = Point(
+				origin.x() + position[0][i],
+				origin.y() + position[1][i],
+				origin.z() + position[2][i]);
+			std::get<2>(points[i]) = Vector(normal[0][i], normal[1][i], normal[2][i]);
+		}
+	});
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		position[axis] = {};
+		normal[axis] = {};
+		updatePosition[axis] = {};
+		updateNormal[axis] = {};
+	}
+
+	return displacements;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ModelData.h"
+#include "NeighborCache.h"
+#include "ThreadPool.h"
+
+#include <functional>
+#include <vector>
+
+//Bilateral point smoothing with the same projection as CGAL::bilateral_smooth_point_set
+//The neighborhoods are found once and reused by every iteration, weights are evaluated in float
+class BilateralSmoother
+{
+	//Float copies of the cloud relative to its first point, swapped with the update buffers every iteration
+	std::vector<float> position[3];
+	std::vector<float> normal[3];
+	std::vector<float> updatePosition[3];
+	std::vector<float> updateNormal[3];
+
+	//CGAL's neighbor radius, 0.95 of the biggest distance to a k-th neighbor
+	float NeighborRadius(const NeighborCache& neighbors, unsigned int k, ThreadPool& pool) const;
+
+	//Projects every point onto its neighbors' planes, returns the mean squared displacement
+	float Iterate(const NeighborCache& neighbors, unsigned int k, float radius, ThreadPool& pool);
+
+public:
+
+	//Control sharpness (0-90), smaller keeps more features
+	float sharpnessAngle = 25;
+
+	//Normals of neighbors facing away are flipped when false, for normals that have not been oriented yet
+	bool orientedNormals = true;
+
+	//Runs up to iterations passes, stops once the RMS displacement of a pass is below stopDisplacement
+	//progress is called after every pass with the iteration and its RMS displacement
+	//Returns the RMS displacement of every pass that ran
+	std::vector<float> Smooth(std::vector<PointWithData>& points, const NeighborCache& neighbors, unsigned int k,
+		int iterations, float stopDisplacement, ThreadPool& pool,
+		const std::function<void(int, float)>& progress);
+};
@@ -0,0 +1,115 @@
+#include "ColorTransfer.h"
+#include "KnnGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool ColorTransfer::Transfer(const std::vector<PointWithData>& points, IndexedMesh& mesh, ThreadPool& pool) const
+{
+	mesh.colors.clear();
+
+	if (points.empty() || mesh.VertexCount() == 0)
+		return false;
+
+	std::vector<Point> positions(points.size());
+	pool.ParallelFor(positions.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+			positions[i] = std::get<0>(points[i]);
+	});
+
+	KnnGrid grid;
+	grid.Build(positions, pool);
+	positions = {};
+
+	std::vector<float> normals;
+	mesh.VertexNormals(normals);
+
+	mesh.colors.resize(mesh.VertexCount() * 3);
+
+	const float falloff = radius > 0 ? 1.0f / (2 * radius * radius) : 0.0f;
+	const unsigned int k = std::max(neighbors, 1u);
+
+	pool.ParallelFor(mesh.VertexCount(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<std::uint32_t> closest;
+		std::vector<float> distanceWeights;
+
+		for (std::size_t v = begin; v < end; ++v)
+		{
+			const float* position = &mesh.vertices[v * 3];
+			const float* normal = &normals[v * 3];
+
+			grid.Query(Point(position[0], position[1], position[2]), k, closest);
+
+			unsigned char* color = &mesh.colors[v * 3];
+			if (closest.empty())
+			{
+				color[0] = color[1] = color[2] = 0;
+				continue;
+			}
+
+			float sum[3] = { 0, 0, 0 };
+			float weightSum = 0;
+			distanceWeights.resize(closest.size());
+
+			for (std::size_t n = 0; n < closest.size(); ++n)
+			{
+				const PointWithData& point = points[closest[n]];
+				const Point& p = std::get<0>(point);
+				const Vector& pointNormal = std::get<2>(point);
+
+				const float dx = static_cast<float>(p.x()) - position[0];
+				const float dy = static_cast<float>(p.y()) - position[1];
+				const float dz = static_cast<float>(p.z()) - position[2];
+				distanceWeights[n] = std::exp(-(dx * dx + dy * dy + dz * dz) * falloff);
+
+				//Points without a normal agree with any vertex
+				float agreement = 1;
+				const float length = static_cast<float>(std::sqrt(pointNormal.squared_length()));
+				if (normalPower > 0 && length > 0)
+				{
+					const float cosine = static_cast<float>(pointNormal.x() * normal[0] + pointNormal.y() * normal[1] + pointNormal.z() * normal[2]) / length;
+					agreement = std::pow(std::max(cosine, 0.0f), normalPower);
+				}
+
+				const float weight = distanceWeights[n] * agreement;
+				const Color& c = std::get<1>(point);
+				for (int channel = 0; channel < 3; ++channel)
+					sum[channel] += weight * c[channel];
+				weightSum += weight;
+			}
+
+			//Every neighbor faces away, on thin parts the distance alone decides
+			if (weightSum <= 0)
+			{
+				for (std::size_t n = 0; n < closest.size(); ++n)
+				{
+					const Color& c = std::get<1>(points[closest[n]]);
+					for (int channel = 0; channel < 3; ++channel)
+						sum[channel] += distanceWeights[n] * c[channel];
+					weightSum += distanceWeights[n];
+				}
+			}
+
+			//Too far for any weight, take the closest point
+			if (weightSum <= 0)
+			{
+				const Color& c = std::get<1>(points[closest[0]]);
+				std::copy(c.begin(), c.end(), color);
+				continue;
+			}
+
+			for (int channel = 0; channel < 3; ++channel)
+				color[channel] = static_cast<unsigned char>(std::min(255.0f, sum[channel] / weightSum + 0.5f));
+		}
+	});
+
+	if (pool.Cancelled())
+	{
+		mesh.colors.clear();
+		return false;
+	}
+
+	return true;
+}
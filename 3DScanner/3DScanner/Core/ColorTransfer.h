@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <vector>
+
+//Colors the vertices of a reconstructed mesh from the k nearest points of the cloud
+//One KnnGrid is built over the cloud and queried by every thread, the blend favors close points facing the same way
+class ColorTransfer
+{
+public:
+
+	//Cloud points blended per vertex
+	unsigned int neighbors = 8;
+
+	//Standard deviation of the distance weight, in model units
+	float radius = 0.001f;
+
+	//Exponent of the normal agreement weight, 0 ignores the normals
+	float normalPower = 2;
+
+	//Fills mesh.colors, false if cancelled or there are no points
+	bool Transfer(const std::vector<PointWithData>& points, IndexedMesh& mesh, ThreadPool& pool) const;
+};
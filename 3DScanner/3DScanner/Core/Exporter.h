@@ -1,34 +1,17 @@
 #pragma once
 
 #include "ModelData.h"
+#include "OBJ_Writer.h"
+#include "PLY_Writer.h"
 
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/property_map.h>
-#include <CGAL/IO/write_ply_points.h>
-#include <CGAL/Polyhedron_3.h>
-#include <CGAL/IO/print_wavefront.h>
-#include <utility>
-#include <vector>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <filesystem>
+#include <string>
 #include <fstream>
 
-namespace CGAL {
-	template< class F >
-	struct Output_rep< ::Color, F > {
-		const ::Color& c;
-		static const bool is_specialized = true;
-		Output_rep(const ::Color& c) : c(c)
-		{ }
-		std::ostream& operator() (std::ostream& out) const
-		{
-			if (is_ascii(out))
-				out << int(c[0]) << " " << int(c[1]) << " " << int(c[2]);
-			else
-				out.write(reinterpret_cast<const char*>(&c), sizeof(c));
-			return out;
-		}
-	};
-}
-
 class Exporter
 {
 
@@ -39,72 +22,101 @@ public:
 		OBJ
 	};
 
+	//name is the file name without its extension
+	//PLY points are binary float unless told otherwise, doubles keep the full precision of the points
 	template<ExportType E>
-	static void Export(PointModel* pointModel);
+	static void Export(const PointModel* pointModel, const std::string& name = "point", bool binary = true, bool doublePrecision = false);
 
 	template<>
-	static void Export<PLY>(PointModel* pointModel);
+	static void Export<PLY>(const PointModel* pointModel, const std::string& name, bool binary, bool doublePrecision);
 
 	template<>
-	static void Export<OBJ>(PointModel* pointModel);
+	static void Export<OBJ>(const PointModel* pointModel, const std::string& name, bool binary, bool doublePrecision);
 
 	template<ExportType E>
-	static void Export(CGAL::Polyhedron_3<Kernel>& pointModel);
+	static void Export(const IndexedMesh& mesh, const std::string& name = "MeshOut");
 
 	template<>
-	static void Export<PLY>(CGAL::Polyhedron_3<Kernel>& pointModel);
+	static void Export<PLY>(const IndexedMesh& mesh, const std::string& name);
 
 	template<>
-	static void Export<OBJ>(CGAL::Polyhedron_3<Kernel>& pointModel);
+	static void Export<OBJ>(const IndexedMesh& mesh, const std::string& name);
+
+	//OBJ with texcoords, its MTL and the texture as PNG
+	static void ExportTextured(const IndexedMesh& mesh, const TextureImage& texture, const std::string& name = "MeshOut");
 };
 
 template <Exporter::ExportType E>
-void Exporter::Export(PointModel* pointModel)
+void Exporter::Export(const PointModel* pointModel, const std::string& name, bool binary, bool doublePrecision)
 {
-	Export<PLY>(pointModel);
+	Export<PLY>(pointModel, name, binary, doublePrecision);
 }
 
 template <Exporter::ExportType E>
-void Exporter::Export(CGAL::Polyhedron_3<Kernel>& pointModel)
+void Exporter::Export(const IndexedMesh& mesh, const std::string& name)
 {
 }
 
 template <>
-inline void Exporter::Export<Exporter::PLY>(PointModel* pointModel)
+inline void Exporter::Export<Exporter::PLY>(const PointModel* pointModel, const std::string& name, bool binary, bool doublePrecision)
 {
-	std::ofstream f("point.ply", std::ios::binary);
-	CGAL::set_binary_mode(f);
-
-	CGAL::write_ply_points_with_properties(
-		f,
-		pointModel->points,
-		make_ply_point_writer(PointMap()),
-		CGAL::make_ply_normal_writer(NormalMap()),
-		std::make_tuple(ColorMap(),
-			CGAL::PLY_property<unsigned char>("red"),
-			CGAL::PLY_property<unsigned char>("green"),
-			CGAL::PLY_property<unsigned char>("blue")));
+	std::ofstream ofs(name + ".ply", std::ios::binary);
+
+	PLY_Writer::PrintPoints(ofs, pointModel->points, binary, doublePrecision);
+
+	ofs.flush();
+	ofs.close();
 }
 
 template <>
-inline void Exporter::Export<Exporter::OBJ>(PointModel* pointModel)
+inline void Exporter::Export<Exporter::OBJ>(const PointModel* pointModel, const std::string& name, bool binary, bool doublePrecision)
 {
 
 }
 
 template <>
-void Exporter::Export<Exporter::PLY>(CGAL::Polyhedron_3<Kernel>& pointModel)
+inline void Exporter::Export<Exporter::PLY>(const IndexedMesh& mesh, const std::string& name)
 {
+	std::ofstream ofs(name + ".ply", std::ios::binary);
+
+	PLY_Writer::PrintMesh(ofs, mesh);
 
+	ofs.flush();
+	ofs.close();
 }
 
 template <>
-void Exporter::Export<Exporter::OBJ>(CGAL::Polyhedron_3<Kernel>& pointModel)
+inline void Exporter::Export<Exporter::OBJ>(const IndexedMesh& mesh, const std::string& name)
 {
 	//Export Mesh
-	std::ofstream ofs("MeshOut.obj");
+	std::ofstream ofs(name + ".obj");
+
+	OBJ_Writer::PrintObj(ofs, mesh);
+
+	ofs.flush();
+	ofs.close();
+}
+
+inline void Exporter::ExportTextured(const IndexedMesh& mesh, const TextureImage& texture, const std::string& name)
+{
+	//OpenCV writes BGR
+	cv::Mat image(texture.height, texture.width, CV_8UC3, const_cast<unsigned char*>(texture.rgb.data()));
+	cv::Mat bgr;
+	cv::cvtColor(image, bgr, cv::COLOR_RGB2BGR);
+	cv::imwrite(name + ".png", bgr);
+
+	//The OBJ and MTL refer to each other by file name, they are written next to each other
+	const std::string fileName = std::filesystem::path(name).filename().string();
+
+	std::ofstream mtl(name + ".mtl");
+	mtl << "newmtl scan\n"
+		<< "Ka 1 1 1\nKd 1 1 1\nKs 0 0 0\nillum 1\n"
+		<< "map_Kd " << fileName << ".png\n";
+	mtl.close();
+
+	std::ofstream ofs(name + ".obj");
 
-	CGAL::print_polyhedron_wavefront(ofs, pointModel);
+	OBJ_Writer::PrintObj(ofs, mesh, fileName + ".mtl", "scan");
 
 	ofs.flush();
 	ofs.close();
@@ -0,0 +1,172 @@
+#include "FrameStore.h"
+
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//Biggest mapping granularity of the supported systems, Windows maps views at 64 KB boundaries
+#define FRAME_ALIGNMENT (64 * 1024)
+
+FrameStore::FrameStore(int width, int height) : width(width), height(height)
+{
+	//Every store gets its own file, a bake may still read the last scan's frames while a new scan is captured
+	static std::atomic<int> nextStore{ 0 };
+
+	std::error_code error;
+	const std::filesystem::path directory = std::filesystem::temp_directory_path(error) / "3DScannerFrames";
+	std::filesystem::create_directories(directory, error);
+
+	path = directory / ("frames" + std::to_string(nextStore++) + ".bin");
+	file.open(path, std::ios::binary | std::ios::trunc);
+
+	const std::size_t frameSize = static_cast<std::size_t>(width) * height * 3;
+	stride = (frameSize + FRAME_ALIGNMENT - 1) / FRAME_ALIGNMENT * FRAME_ALIGNMENT;
+}
+
+FrameStore::~FrameStore()
+{
+	CloseMapping();
+	file.close();
+
+	std::error_code error;
+	std::filesystem::remove(path, error);
+}
+
+int FrameStore::Append(const unsigned char* rgba)
+{
+	std::lock_guard<std::mutex> lock(mapMutex);
+
+	if (!file.good() || views)
+		return -1;
+
+	std::vector<unsigned char> frame(stride, 0);
+	const std::size_t pixels = static_cast<std::size_t>(width) * height;
+
+	for (std::size_t i = 0; i < pixels; ++i)
+	{
+		frame[i * 3] = rgba[i * 4];
+		frame[i * 3 + 1] = rgba[i * 4 + 1];
+		frame[i * 3 + 2] = rgba[i * 4 + 2];
+	}
+
+	file.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+
+	return file.good() ? frameCount++ : -1;
+}
+
+bool FrameStore::Map()
+{
+	std::lock_guard<std::mutex> lock(mapMutex);
+
+	if (views)
+		return true;
+
+	file.flush();
+
+	if (frameCount == 0)
+		return false;
+
+#ifdef _WIN32
+	fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		fileHandle = nullptr;
+		return false;
+	}
+
+	mapping = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(fileHandle);
+		fileHandle = nullptr;
+		return false;
+	}
+#else
+	descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+#endif
+
+	views = std::make_unique<std::atomic<const unsigned char*>[]>(frameCount);
+	for (int i = 0; i < frameCount; ++i)
+		views[i] = nullptr;
+
+	return true;
+}
+
+void FrameStore::CloseMapping()
+{
+	if (views)
+	{
+		for (int i = 0; i < frameCount; ++i)
+		{
+			const unsigned char* view = views[i].load();
+			if (!view)
+				continue;
+
+#ifdef _WIN32
+			UnmapViewOfFile(view);
+#else
+			munmap(const_cast<unsigned char*>(view), stride);
+#endif
+		}
+
+		views.reset();
+	}
+
+#ifdef _WIN32
+	if (mapping)
+		CloseHandle(mapping);
+	if (fileHandle)
+		CloseHandle(fileHandle);
+	mapping = nullptr;
+	fileHandle = nullptr;
+#else
+	if (descriptor >= 0)
+		close(descriptor);
+	descriptor = -1;
+#endif
+}
+
+const unsigned char* FrameStore::Frame(int frame)
+{
+	if (!views || frame < 0 || frame >= frameCount)
+		return nullptr;
+
+	//Mapped already, no lock needed
+	const unsigned char* view = views[frame].load(std::memory_order_acquire);
+	if (view)
+		return view;
+
+	std::lock_guard<std::mutex> lock(mapMutex);
+
+	view = views[frame].load(std::memory_order_acquire);
+	if (view)
+		return view;
+
+	const std::size_t offset = static_cast<std::size_t>(frame) * stride;
+
+#ifdef _WIN32
+	view = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ,
+		static_cast<DWORD>(static_cast<std::uint64_t>(offset) >> 32), static_cast<DWORD>(offset & 0xffffffffu), stride));
+#else
+	void* mapped = mmap(nullptr, stride, PROT_READ, MAP_SHARED, descriptor, static_cast<off_t>(offset));
+	view = mapped == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(mapped);
+#endif
+
+	views[frame].store(view, std::memory_order_release);
+	return view;
+}
+
+void FrameStore::Release()
+{
+	std::lock_guard<std::mutex> lock(mapMutex);
+	CloseMapping();
+}
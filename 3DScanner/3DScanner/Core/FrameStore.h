@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//Color frames of a scan kept in a file instead of memory, one RGB frame per captured shot
+//Frames are memory mapped one at a time when first read, so a bake only maps the frames it samples
+class FrameStore
+{
+	std::filesystem::path path;
+	std::ofstream file;
+
+	int width = 0;
+	int height = 0;
+	int frameCount = 0;
+
+	//Bytes between frames, a multiple of the mapping granularity so every frame maps on its own
+	std::size_t stride = 0;
+
+	//Mapped view of every frame, nullptr until it is read
+	std::unique_ptr<std::atomic<const unsigned char*>[]> views;
+	std::mutex mapMutex;
+
+#ifdef _WIN32
+	void* mapping = nullptr;
+	void* fileHandle = nullptr;
+#else
+	int descriptor = -1;
+#endif
+
+	void CloseMapping();
+
+public:
+
+	FrameStore(int width, int height);
+	~FrameStore();
+
+	FrameStore(const FrameStore&) = delete;
+	FrameStore& operator=(const FrameStore&) = delete;
+
+	//Appends a 4 byte per pixel RGBA frame as RGB, returns its index or -1
+	int Append(const unsigned char* rgba);
+
+	//Opens the file for reading, no frame is mapped yet and no frame can be appended until Release
+	bool Map();
+
+	//RGB pixels of a frame, mapped on its first read from any thread, nullptr if the frame cannot be read
+	const unsigned char* Frame(int frame);
+
+	//Unmaps every frame and allows appending again
+	void Release();
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	int GetFrameCount() const { return frameCount; }
+};
@@ -0,0 +1,396 @@
+#include "KnnGrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KNN_SSE 1
+#endif
+
+//Morton codes hold 21 bits per axis
+#define KNN_MAX_CELLS (1 << 21)
+
+std::uint64_t KnnGrid::MortonCode(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+	auto spread = [](std::uint64_t v)
+	{
+		v &= 0x1fffff;
+		v = (v | v << 32) & 0x1f00000000ffffull;
+		v = (v | v << 16) & 0x1f0000ff0000ffull;
+		v = (v | v << 8) & 0x100f00f00f00f00full;
+		v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+		v = (v | v << 2) & 0x1249249249249249ull;
+		return v;
+	};
+
+	return spread(x) | spread(y) << 1 | spread(z) << 2;
+}
+
+const KnnGrid::Bucket* KnnGrid::FindBucket(std::uint64_t code) const
+{
+	std::uint64_t slot = (code * 0x9E3779B97F4A7C15ull) & bucketMask;
+
+	while (buckets[slot].code != EmptyCode)
+	{
+		if (buckets[slot].code == code)
+			return &buckets[slot];
+
+		slot = (slot + 1) & bucketMask;
+	}
+
+	return nullptr;
+}
+
+void KnnGrid::Clear()
+{
+	xs.clear();
+	ys.clear();
+	zs.clear();
+	order.clear();
+	buckets.clear();
+	bucketMask = 0;
+	cellSize = 0;
+}
+
+void KnnGrid::Build(const std::vector<Point>& positions, ThreadPool& pool)
+{
+	Clear();
+
+	const std::size_t count = positions.size();
+	if (count == 0)
+		return;
+
+	double minValue[3] = { positions[0].x(), positions[0].y(), positions[0].z() };
+	double maxValue[3] = { minValue[0], minValue[1], minValue[2] };
+
+	for (const Point& position : positions)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			minValue[axis] = std::min(minValue[axis], position[axis]);
+			maxValue[axis] = std::max(maxValue[axis], position[axis]);
+		}
+	}
+
+	origin = Point(minValue[0], minValue[1], minValue[2]);
+
+	const double extent[3] = {
+		std::max(maxValue[0] - minValue[0], 1e-6),
+		std::max(maxValue[1] - minValue[1], 1e-6),
+		std::max(maxValue[2] - minValue[2], 1e-6) };
+
+	//First guess assumes the points fill the box
+	double size = std::cbrt(extent[0] * extent[1] * extent[2] * pointsPerCell / count);
+
+	std::vector<std::pair<std::uint64_t, std::uint32_t>> codes(count);
+
+	auto computeCodes = [&](double cell)
+	{
+		cellSize = static_cast<float>(cell);
+		for (int axis = 0; axis < 3; ++axis)
+			cellCount[axis] = std::min(KNN_MAX_CELLS, static_cast<int>(extent[axis] / cell) + 1);
+
+		pool.ParallelFor(count, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				std::uint32_t cellIndex[3];
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					const int c = static_cast<int>((positions[i][axis] - minValue[axis]) / cell);
+					cellIndex[axis] = static_cast<std::uint32_t>(std::clamp(c, 0, cellCount[axis] - 1));
+				}
+
+				codes[i] = { MortonCode(cellIndex[0], cellIndex[1], cellIndex[2]), static_cast<std::uint32_t>(i) };
+			}
+		});
+
+		std::sort(codes.begin(), codes.end());
+	};
+
+	computeCodes(size);
+
+	//Scans are surfaces, so the occupancy grows with the square of the cell size
+	std::size_t occupied = 1;
+	for (std::size_t i = 1; i < count; ++i)
+		occupied += codes[i].first != codes[i - 1].first;
+
+	const double perCell = static_cast<double>(count) / occupied;
+	size *= std::sqrt(pointsPerCell / perCell);
+	size = std::max(size, std::max(extent[0], std::max(extent[1], extent[2])) / (KNN_MAX_CELLS - 1));
+
+	computeCodes(size);
+
+	xs.resize(count);
+	ys.resize(count);
+	zs.resize(count);
+	order.resize(count);
+
+	pool.ParallelFor(count, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const Point& position = positions[codes[i].second];
+			xs[i] = static_cast<float>(position.x() - minValue[0]);
+			ys[i] = static_cast<float>(position.y() - minValue[1]);
+			zs[i] = static_cast<float>(position.z() - minValue[2]);
+			order[i] = codes[i].second;
+		}
+	});
+
+	occupied = 1;
+	for (std::size_t i = 1; i < count; ++i)
+		occupied += codes[i].first != codes[i - 1].first;
+
+	std::size_t tableSize = 1;
+	while (tableSize < occupied * 2)
+		tableSize <<= 1;
+
+	buckets.assign(tableSize, Bucket());
+	bucketMask = tableSize - 1;
+
+	for (std::size_t begin = 0; begin < count;)
+	{
+		std::size_t end = begin + 1;
+		while (end < count && codes[end].first == codes[begin].first)
+			++end;
+
+		std::uint64_t slot = (codes[begin].first * 0x9E3779B97F4A7C15ull) & bucketMask;
+		while (buckets[slot].code != EmptyCode)
+			slot = (slot + 1) & bucketMask;
+
+		buckets[slot].code = codes[begin].first;
+		buckets[slot].begin = static_cast<std::uint32_t>(begin);
+		buckets[slot].end = static_cast<std::uint32_t>(end);
+
+		begin = end;
+	}
+}
+
+void KnnGrid::ScanBucket(const Bucket& bucket, float x, float y, float z, float worst, Candidates& best) const
+{
+	std::uint32_t i = bucket.begin;
+
+#ifdef KNN_SSE
+	const __m128 qx = _mm_set1_ps(x);
+	const __m128 qy = _mm_set1_ps(y);
+	const __m128 qz = _mm_set1_ps(z);
+	const __m128 limit = _mm_set1_ps(worst);
+
+	for (; i + 4 <= bucket.end; i += 4)
+	{
+		const __m128 dx = _mm_sub_ps(_mm_loadu_ps(&xs[i]), qx);
+		const __m128 dy = _mm_sub_ps(_mm_loadu_ps(&ys[i]), qy);
+		const __m128 dz = _mm_sub_ps(_mm_loadu_ps(&zs[i]), qz);
+		const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		//Once a shell is done most candidates are further than the current worst
+		const int closer = _mm_movemask_ps(_mm_cmple_ps(distance, limit));
+		if (!closer)
+			continue;
+
+		alignas(16) float distances[4];
+		_mm_store_ps(distances, distance);
+
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			if (closer & (1 << lane))
+				best.emplace_back(distances[lane], i + lane);
+		}
+	}
+#endif
+
+	for (; i < bucket.end; ++i)
+	{
+		const float dx = xs[i] - x;
+		const float dy = ys[i] - y;
+		const float dz = zs[i] - z;
+		const float distance = dx * dx + dy * dy + dz * dz;
+
+		if (distance <= worst)
+			best.emplace_back(distance, i);
+	}
+}
+
+void KnnGrid::Search(float x, float y, float z, std::size_t count, Candidates& best) const
+{
+	best.clear();
+
+	if (order.empty())
+		return;
+
+	count = std::min(count, order.size());
+
+	const int center[3] = {
+		std::clamp(static_cast<int>(x / cellSize), 0, cellCount[0] - 1),
+		std::clamp(static_cast<int>(y / cellSize), 0, cellCount[1] - 1),
+		std::clamp(static_cast<int>(z / cellSize), 0, cellCount[2] - 1) };
+
+	const float query[3] = { x, y, z };
+	const int maxRing = std::max(cellCount[0], std::max(cellCount[1], cellCount[2]));
+
+	//Squared distance of the count-th closest point so far
+	float worst = std::numeric_limits<float>::max();
+
+	//Candidates are gathered a whole shell at a time, then trimmed to the closest count
+	for (int ring = 0; ring <= maxRing; ++ring)
+	{
+		for (int dz = -ring; dz <= ring; ++dz)
+		{
+			const int cz = center[2] + dz;
+			if (cz < 0 || cz >= cellCount[2])
+				continue;
+
+			for (int dy = -ring; dy <= ring; ++dy)
+			{
+				const int cy = center[1] + dy;
+				if (cy < 0 || cy >= cellCount[1])
+					continue;
+
+				//Inside the shell only the two x faces are new
+				const bool face = std::abs(dz) == ring || std::abs(dy) == ring;
+				const int step = face ? 1 : std::max(1, 2 * ring);
+
+				for (int dx = -ring; dx <= ring; dx += step)
+				{
+					const int cx = center[0] + dx;
+					if (cx < 0 || cx >= cellCount[0])
+						continue;
+
+					//Skip voxels that cannot hold anything closer than the current worst
+					const int cell[3] = { cx, cy, cz };
+					float boxDistance = 0;
+
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						const float low = cell[axis] * cellSize;
+						const float gap = std::max(std::max(low - query[axis], query[axis] - (low + cellSize)), 0.0f);
+						boxDistance += gap * gap;
+					}
+
+					if (boxDistance > worst)
+						continue;
+
+					const Bucket* bucket = FindBucket(MortonCode(cx, cy, cz));
+					if (bucket)
+						ScanBucket(*bucket, x, y, z, worst, best);
+				}
+			}
+		}
+
+		if (best.size() < count)
+			continue;
+
+		if (best.size() > count)
+		{
+			std::nth_element(best.begin(), best.begin() + (count - 1), best.end());
+			best.resize(count);
+		}
+
+		worst = std::max_element(best.begin(), best.end())->first;
+
+		//Everything closer than the searched cube's nearest face has been seen
+		float reach = std::numeric_limits<float>::max();
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float low = (center[axis] - ring) * cellSize;
+			const float high = (center[axis] + ring + 1) * cellSize;
+			reach = std::min(reach, std::min(query[axis] - low, high - query[axis]));
+		}
+
+		if (worst <= reach * reach)
+			break;
+	}
+
+	if (best.size() > count)
+	{
+		std::nth_element(best.begin(), best.begin() + (count - 1), best.end());
+		best.resize(count);
+	}
+
+	std::sort(best.begin(), best.end());
+}
+
+void KnnGrid::QueryAll(unsigned int k, std::uint32_t* out, ThreadPool& pool) const
+{
+	const std::size_t stride = k + 1;
+
+	//Queries run in Morton order so neighboring queries touch the same voxels
+	pool.ParallelFor(order.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		Candidates best;
+		best.reserve(stride * 8);
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			Search(xs[i], ys[i], zs[i], stride, best);
+
+			std::uint32_t* list = out + static_cast<std::size_t>(order[i]) * stride;
+			std::size_t found = 0;
+
+			for (; found < best.size(); ++found)
+				list[found] = order[best[found].second];
+
+			//Less points than k, repeat the furthest one so every list has the same length
+			for (; found < stride; ++found)
+				list[found] = found > 0 ? list[found - 1] : order[i];
+		}
+	});
+}
+
+void KnnGrid::Query(const Point& position, unsigned int k, std::vector<std::uint32_t>& out) const
+{
+	Candidates best;
+	Search(
+		static_cast<float>(position.x() - origin.x()),
+		static_cast<float>(position.y() - origin.y()),
+		static_cast<float>(position.z() - origin.z()),
+		k, best);
+
+	out.resize(best.size());
+	for (std::size_t i = 0; i < best.size(); ++i)
+		out[i] = order[best[i].second];
+}
+
+void KnnGrid::QueryRadius(const Point& position, float radius, std::vector<std::uint32_t>& out) const
+{
+	out.clear();
+
+	if (order.empty())
+		return;
+
+	const float query[3] = {
+		static_cast<float>(position.x() - origin.x()),
+		static_cast<float>(position.y() - origin.y()),
+		static_cast<float>(position.z() - origin.z()) };
+
+	//Points outside the grid were clamped into its border voxels, so the range is clamped the same way
+	int low[3];
+	int high[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		low[axis] = std::clamp(static_cast<int>(std::floor((query[axis] - radius) / cellSize)), 0, cellCount[axis] - 1);
+		high[axis] = std::clamp(static_cast<int>(std::floor((query[axis] + radius) / cellSize)), 0, cellCount[axis] - 1);
+	}
+
+	Candidates found;
+
+	for (int cz = low[2]; cz <= high[2]; ++cz)
+	{
+		for (int cy = low[1]; cy <= high[1]; ++cy)
+		{
+			for (int cx = low[0]; cx <= high[0]; ++cx)
+			{
+				const Bucket* bucket = FindBucket(MortonCode(cx, cy, cz));
+				if (bucket)
+					ScanBucket(*bucket, query[0], query[1], query[2], radius * radius, found);
+			}
+		}
+	}
+
+	out.resize(found.size());
+	for (std::size_t i = 0; i < found.size(); ++i)
+		out[i] = order[found[i].second];
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <vector>
+
+//Fixed k nearest neighbor search tuned for the pipeline's neighborhood sizes (10, 24 and 120)
+//Points are sorted by the Morton code of their voxel and stored as float arrays, every occupied voxel is a contiguous bucket
+class KnnGrid
+{
+	//Float positions relative to origin, in Morton order
+	std::vector<float> xs;
+	std::vector<float> ys;
+	std::vector<float> zs;
+
+	//Original index of every sorted point
+	std::vector<std::uint32_t> order;
+
+	static const std::uint64_t EmptyCode = ~0ull;
+
+	//Open addressing table from voxel Morton code to its bucket
+	struct Bucket
+	{
+		std::uint64_t code = EmptyCode;
+		std::uint32_t begin = 0;
+		std::uint32_t end = 0;
+	};
+	std::vector<Bucket> buckets;
+	std::uint64_t bucketMask = 0;
+
+	Point origin;
+	float cellSize = 0;
+	int cellCount[3] = { 0, 0, 0 };
+
+	static std::uint64_t MortonCode(std::uint32_t x, std::uint32_t y, std::uint32_t z);
+
+	const Bucket* FindBucket(std::uint64_t code) const;
+
+	//Squared distance and sorted index of the closest points found so far
+	typedef std::vector<std::pair<float, std::uint32_t>> Candidates;
+
+	//Collects the count closest sorted points to (x, y, z), expanding voxel shells until no closer point can exist
+	void Search(float x, float y, float z, std::size_t count, Candidates& best) const;
+
+	//Distances to a bucket's points, appending the ones not further than worst
+	void ScanBucket(const Bucket& bucket, float x, float y, float z, float worst, Candidates& best) const;
+
+public:
+
+	//Points expected per voxel, a few so the innermost rings hold a small neighborhood
+	float pointsPerCell = 8;
+
+	void Build(const std::vector<Point>& positions, ThreadPool& pool);
+
+	//k + 1 nearest points (the point itself included) of every point, sorted by distance
+	//out holds (k + 1) entries per point in original index order
+	void QueryAll(unsigned int k, std::uint32_t* out, ThreadPool& pool) const;
+
+	//k nearest points to any position, sorted by distance
+	void Query(const Point& position, unsigned int k, std::vector<std::uint32_t>& out) const;
+
+	//Every point within radius of any position, unordered
+	//Voxels are sized for the k nearest search, raise pointsPerCell before Build when the radius spans many of them
+	void QueryRadius(const Point& position, float radius, std::vector<std::uint32_t>& out) const;
+
+	std::size_t Size() const { return order.size(); }
+
+	void Clear();
+};
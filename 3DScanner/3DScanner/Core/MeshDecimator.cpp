@@ -0,0 +1,622 @@
+#include "MeshDecimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+//Collapses between checks for a cancelled run
+#define DECIMATE_CANCEL_CHECK 1024
+
+//Cosine of the largest turn of a face normal in one collapse
+#define DECIMATE_MAX_TURN 0.5
+
+//Smallest compactness of a face a collapse may create, 1 for an equilateral triangle
+#define DECIMATE_MIN_QUALITY 0.1
+
+namespace
+{
+	typedef std::array<double, 3> Vec3;
+
+	Vec3 Sub(const Vec3& a, const Vec3& b) { return { a[0] - b[0], a[1] - b[1], a[2] - b[2] }; }
+	double Dot(const Vec3& a, const Vec3& b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+	Vec3 Cross(const Vec3& a, const Vec3& b) { return { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] }; }
+}
+
+void MeshDecimator::Quadric::AddPlane(double nx, double ny, double nz, double d, double weight)
+{
+	a[0] += weight * nx * nx;
+	a[1] += weight * nx * ny;
+	a[2] += weight * nx * nz;
+	a[3] += weight * nx * d;
+	a[4] += weight * ny * ny;
+	a[5] += weight * ny * nz;
+	a[6] += weight * ny * d;
+	a[7] += weight * nz * nz;
+	a[8] += weight * nz * d;
+	a[9] += weight * d * d;
+	this->weight += weight;
+}
+
+void MeshDecimator::Quadric::Add(const Quadric& other)
+{
+	for (int i = 0; i < 10; ++i)
+		a[i] += other.a[i];
+	weight += other.weight;
+}
+
+double MeshDecimator::Quadric::Error(const Vec3& p) const
+{
+	const double x = p[0], y = p[1], z = p[2];
+
+	return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+		+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+		+ a[7] * z * z + 2 * a[8] * z
+		+ a[9];
+}
+
+double MeshDecimator::Quadric::MeanError(const Vec3& p) const
+{
+	return weight > 0 ? Error(p) / weight : 0;
+}
+
+bool MeshDecimator::Quadric::Minimum(Vec3& p) const
+{
+	//Cramer's rule on the upper 3x3 block
+	const double determinant =
+		a[0] * (a[4] * a[7] - a[5] * a[5]) -
+		a[1] * (a[1] * a[7] - a[5] * a[2]) +
+		a[2] * (a[1] * a[5] - a[4] * a[2]);
+
+	const double scale = std::abs(a[0]) + std::abs(a[4]) + std::abs(a[7]);
+	if (std::abs(determinant) <= 1e-12 * scale * scale * scale)
+		return false;
+
+	const double b0 = -a[3], b1 = -a[6], b2 = -a[8];
+
+	p[0] = (b0 * (a[4] * a[7] - a[5] * a[5]) - a[1] * (b1 * a[7] - a[5] * b2) + a[2] * (b1 * a[5] - a[4] * b2)) / determinant;
+	p[1] = (a[0] * (b1 * a[7] - a[5] * b2) - b0 * (a[1] * a[7] - a[5] * a[2]) + a[2] * (a[1] * b2 - b1 * a[2])) / determinant;
+	p[2] = (a[0] * (a[4] * b2 - b1 * a[5]) - a[1] * (a[1] * b2 - b1 * a[2]) + b0 * (a[1] * a[5] - a[4] * a[2])) / determinant;
+
+	return true;
+}
+
+bool MeshDecimator::Candidate::operator<(const Candidate& other) const
+{
+	//priority_queue keeps the largest on top, so the cheapest collapse compares largest
+	if (cost != other.cost)
+		return cost > other.cost;
+	if (from != other.from)
+		return from > other.from;
+	return to > other.to;
+}
+
+void MeshDecimator::Load(const IndexedMesh& mesh)
+{
+	const std::size_t vertexCount = mesh.VertexCount();
+
+	positions.resize(vertexCount);
+	for (std::size_t v = 0; v < vertexCount; ++v)
+		positions[v] = { mesh.vertices[v * 3], mesh.vertices[v * 3 + 1], mesh.vertices[v * 3 + 2] };
+
+	faces.clear();
+	faces.reserve(mesh.TriangleCount());
+
+	for (std::size_t f = 0; f < mesh.TriangleCount(); ++f)
+	{
+		const std::array<std::uint32_t, 3> face = { mesh.triangles[f * 3], mesh.triangles[f * 3 + 1], mesh.triangles[f * 3 + 2] };
+
+		//Degenerate faces carry no surface
+		if (face[0] != face[1] && face[1] != face[2] && face[0] != face[2])
+			faces.push_back(face);
+	}
+
+	faceAlive.assign(faces.size(), 1);
+	vertexAlive.assign(vertexCount, 1);
+	stamps.assign(vertexCount, 0);
+
+	vertexFaces.assign(vertexCount, std::vector<std::uint32_t>());
+	for (std::size_t f = 0; f < faces.size(); ++f)
+	{
+		for (std::uint32_t v : faces[f])
+			vertexFaces[v].push_back(static_cast<std::uint32_t>(f));
+	}
+}
+
+void MeshDecimator::Store(IndexedMesh& mesh) const
+{
+	std::vector<char> used(positions.size(), 0);
+	std::vector<std::uint32_t> remap(positions.size(), 0);
+
+	mesh.Clear();
+
+	for (std::size_t f = 0; f < faces.size(); ++f)
+	{
+		if (faceAlive[f])
+		{
+			for (std::uint32_t v : faces[f])
+				used[v] = 1;
+		}
+	}
+
+	//Vertices keep their relative order
+	std::uint32_t next = 0;
+	for (std::size_t v = 0; v < positions.size(); ++v)
+	{
+		if (!used[v])
+			continue;
+
+		remap[v] = next++;
+		for (int axis = 0; axis < 3; ++axis)
+			mesh.vertices.push_back(static_cast<float>(positions[v][axis]));
+	}
+
+	for (std::size_t f = 0; f < faces.size(); ++f)
+	{
+		if (faceAlive[f])
+		{
+			for (std::uint32_t v : faces[f])
+				mesh.triangles.push_back(remap[v]);
+		}
+	}
+}
+
+double MeshDecimator::Compactness(const std::array<std::uint32_t, 3>& face) const
+{
+	//4 sqrt(3) area over the summed squared edges
+	const Vec3 normal = Cross(Sub(positions[face[1]], positions[face[0]]), Sub(positions[face[2]], positions[face[0]]));
+
+	double edges = 0;
+	for (int c = 0; c < 3; ++c)
+	{
+		const Vec3 edge = Sub(positions[face[(c + 1) % 3]], positions[face[c]]);
+		edges += Dot(edge, edge);
+	}
+
+	return edges > 0 ? 2 * std::sqrt(3.0 * Dot(normal, normal)) / edges : 0;
+}
+
+bool MeshDecimator::MakeCandidate(std::uint32_t from, std::uint32_t to, Candidate& candidate) const
+{
+	if (!vertexAlive[from] || !vertexAlive[to])
+		return false;
+
+	Quadric quadric = quadrics[from];
+	quadric.Add(quadrics[to]);
+
+	const Vec3& a = positions[from];
+	const Vec3& b = positions[to];
+	const Vec3 middle = { (a[0] + b[0]) / 2, (a[1] + b[1]) / 2, (a[2] + b[2]) / 2 };
+
+	//The optimal position, unless it is far off the edge because the quadric is nearly flat
+	Vec3 best;
+	const Vec3 edge = Sub(b, a);
+	if (quadric.Minimum(best) && Dot(Sub(best, middle), Sub(best, middle)) <= Dot(edge, edge))
+	{
+		candidate.cost = quadric.MeanError(best);
+	}
+	else
+	{
+		best = middle;
+		candidate.cost = quadric.MeanError(middle);
+
+		for (const Vec3* end : { &a, &b })
+		{
+			const double cost = quadric.MeanError(*end);
+			if (cost < candidate.cost)
+			{
+				candidate.cost = cost;
+				best = *end;
+			}
+		}
+	}
+
+	candidate.cost = std::max(candidate.cost, 0.0);
+	candidate.from = from;
+	candidate.to = to;
+	candidate.fromStamp = stamps[from];
+	candidate.toStamp = stamps[to];
+	candidate.position = best;
+
+	return true;
+}
+
+bool MeshDecimator::CanCollapse(const Candidate& candidate) const
+{
+	const std::uint32_t from = candidate.from;
+	const std::uint32_t to = candidate.to;
+
+	//Link condition, the rings of the two vertices only share the vertices opposite the edge
+	std::vector<std::uint32_t> fromRing;
+	std::vector<std::uint32_t> toRing;
+	std::size_t edgeFaces = 0;
+
+	for (std::uint32_t f : vertexFaces[from])
+	{
+		bool hasTo = false;
+		for (std::uint32_t v : faces[f])
+		{
+			hasTo |= v == to;
+			if (v != from)
+				fromRing.push_back(v);
+		}
+		edgeFaces += hasTo;
+	}
+
+	if (edgeFaces == 0)
+		return false;
+
+	for (std::uint32_t f : vertexFaces[to])
+	{
+		for (std::uint32_t v : faces[f])
+		{
+			if (v != to)
+				toRing.push_back(v);
+		}
+	}
+
+	std::sort(fromRing.begin(), fromRing.end());
+	fromRing.erase(std::unique(fromRing.begin(), fromRing.end()), fromRing.end());
+	std::sort(toRing.begin(), toRing.end());
+	toRing.erase(std::unique(toRing.begin(), toRing.end()), toRing.end());
+
+	std::size_t shared = 0;
+	for (std::size_t i = 0, j = 0; i < fromRing.size() && j < toRing.size();)
+	{
+		if (fromRing[i] < toRing[j])
+			++i;
+		else if (toRing[j] < fromRing[i])
+			++j;
+		else
+		{
+			++shared;
+			++i;
+			++j;
+		}
+	}
+
+	if (shared != edgeFaces)
+		return false;
+
+	//No face around the edge may turn by more than DECIMATE_MAX_TURN or collapse to a line
+	for (std::uint32_t moved : { from, to })
+	{
+		for (std::uint32_t f : vertexFaces[moved])
+		{
+			const auto& face = faces[f];
+			if (std::find(face.begin(), face.end(), from) != face.end() && std::find(face.begin(), face.end(), to) != face.end())
+				continue;
+
+			Vec3 corner[3];
+			for (int c = 0; c < 3; ++c)
+				corner[c] = face[c] == moved ? candidate.position : positions[face[c]];
+
+			const Vec3 before = Cross(Sub(positions[face[1]], positions[face[0]]), Sub(positions[face[2]], positions[face[0]]));
+			const Vec3 after = Cross(Sub(corner[1], corner[0]), Sub(corner[2], corner[0]));
+
+			const double beforeLength = Dot(before, before);
+			const double afterLength = Dot(after, after);
+			if (afterLength <= 1e-6 * beforeLength || Dot(before, after) < DECIMATE_MAX_TURN * std::sqrt(beforeLength * afterLength))
+				return false;
+
+			//Slivers are only allowed where there already was one
+			double edges = 0;
+			for (int c = 0; c < 3; ++c)
+				edges += Dot(Sub(corner[(c + 1) % 3], corner[c]), Sub(corner[(c + 1) % 3], corner[c]));
+
+			if (2 * std::sqrt(3.0 * afterLength) < DECIMATE_MIN_QUALITY * edges && Compactness(face) >= DECIMATE_MIN_QUALITY)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+std::size_t MeshDecimator::Collapse(const Candidate& candidate)
+{
+	const std::uint32_t from = candidate.from;
+	const std::uint32_t to = candidate.to;
+	std::size_t removed = 0;
+
+	for (std::uint32_t f : vertexFaces[from])
+	{
+		auto& face = faces[f];
+
+		if (std::find(face.begin(), face.end(), to) != face.end())
+		{
+			//The faces along the edge disappear
+			faceAlive[f] = 0;
+			++removed;
+
+			for (std::uint32_t v : face)
+			{
+				if (v == from)
+					continue;
+
+				auto& list = vertexFaces[v];
+				list.erase(std::find(list.begin(), list.end(), f));
+			}
+		}
+		else
+		{
+			*std::find(face.begin(), face.end(), from) = to;
+			vertexFaces[to].push_back(f);
+		}
+	}
+
+	vertexFaces[from].clear();
+	vertexAlive[from] = 0;
+	++stamps[from];
+	++stamps[to];
+
+	positions[to] = candidate.position;
+	quadrics[to].Add(quadrics[from]);
+
+	return removed;
+}
+
+std::size_t MeshDecimator::DecimateBlock(const std::vector<std::uint32_t>& vertices, std::size_t removeGoal, double maxCost, const ThreadPool& pool)
+{
+	if (removeGoal == 0)
+		return 0;
+
+	auto movable = [&](std::uint32_t a, std::uint32_t b) { return !locked[a] && !locked[b] && block[a] == block[b]; };
+
+	//Every edge between two movable vertices of the block once
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+	for (std::uint32_t u : vertices)
+	{
+		if (!vertexAlive[u] || locked[u])
+			continue;
+
+		for (std::uint32_t f : vertexFaces[u])
+		{
+			for (std::uint32_t w : faces[f])
+			{
+				if (w > u && movable(u, w))
+					edges.emplace_back(u, w);
+			}
+		}
+	}
+
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	std::vector<Candidate> initial;
+	initial.reserve(edges.size());
+
+	Candidate candidate;
+	for (const auto& edge : edges)
+	{
+		if (MakeCandidate(edge.first, edge.second, candidate))
+			initial.push_back(candidate);
+	}
+
+	std::priority_queue<Candidate> heap(std::less<Candidate>(), std::move(initial));
+
+	std::size_t removed = 0;
+	std::size_t collapses = 0;
+	std::vector<std::uint32_t> ring;
+
+	while (removed < removeGoal && !heap.empty())
+	{
+		const Candidate top = heap.top();
+		heap.pop();
+
+		if (maxCost > 0 && top.cost > maxCost)
+			break;
+
+		if (!vertexAlive[top.from] || !vertexAlive[top.to] || stamps[top.from] != top.fromStamp || stamps[top.to] != top.toStamp)
+			continue;
+
+		if (!CanCollapse(top))
+			continue;
+
+		removed += Collapse(top);
+
+		if (++collapses % DECIMATE_CANCEL_CHECK == 0 && pool.Cancelled())
+			break;
+
+		//The surviving vertex moved, its edges get new costs
+		ring.clear();
+		for (std::uint32_t f : vertexFaces[top.to])
+		{
+			for (std::uint32_t v : faces[f])
+			{
+				if (v != top.to && movable(v, top.to))
+					ring.push_back(v);
+			}
+		}
+
+		std::sort(ring.begin(), ring.end());
+		ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+
+		for (std::uint32_t v : ring)
+		{
+			if (MakeCandidate(v, top.to, candidate))
+				heap.push(candidate);
+		}
+	}
+
+	return removed;
+}
+
+void MeshDecimator::AssignBlocks(const Vec3& origin, double size, int count, double offset, std::vector<std::vector<std::uint32_t>>& blockVertices, ThreadPool& pool)
+{
+	//Shifted blocks need one more per axis to cover the mesh
+	const int cells = size > 0 ? count + (offset > 0) : 1;
+
+	block.assign(positions.size(), 0);
+	blockVertices.assign(static_cast<std::size_t>(cells) * cells * cells, std::vector<std::uint32_t>());
+
+	for (std::uint32_t v = 0; v < positions.size(); ++v)
+	{
+		if (!vertexAlive[v])
+			continue;
+
+		if (size > 0)
+		{
+			int cell[3];
+			for (int axis = 0; axis < 3; ++axis)
+				cell[axis] = std::clamp(static_cast<int>(std::floor((positions[v][axis] - origin[axis] + offset) / size)), 0, cells - 1);
+
+			block[v] = static_cast<std::uint32_t>((cell[2] * cells + cell[1]) * cells + cell[0]);
+		}
+
+		blockVertices[block[v]].push_back(v);
+	}
+
+	//A vertex whose ring reaches another block is shared with that block's thread
+	locked.assign(positions.size(), 0);
+
+	pool.ParallelFor(positions.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t v = begin; v < end; ++v)
+		{
+			if (!vertexAlive[v] || fixed[v])
+			{
+				locked[v] = 1;
+				continue;
+			}
+
+			for (std::uint32_t f : vertexFaces[v])
+			{
+				for (std::uint32_t w : faces[f])
+					locked[v] |= block[w] != block[v];
+			}
+		}
+	});
+}
+
+bool MeshDecimator::Decimate(IndexedMesh& mesh, ThreadPool& pool, const std::function<void(float)>& progress)
+{
+	if (mesh.TriangleCount() == 0 || (targetFaces == 0 && maxError <= 0) || (targetFaces > 0 && mesh.TriangleCount() <= targetFaces && maxError <= 0))
+		return true;
+
+	Load(mesh);
+
+	//Area weighted plane of every face, summed per vertex
+	quadrics.assign(positions.size(), Quadric());
+	fixed.assign(positions.size(), 0);
+
+	pool.ParallelFor(positions.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<std::uint32_t> ring;
+
+		for (std::size_t v = begin; v < end; ++v)
+		{
+			ring.clear();
+
+			for (std::uint32_t f : vertexFaces[v])
+			{
+				const auto& face = faces[f];
+				const Vec3 normal = Cross(Sub(positions[face[1]], positions[face[0]]), Sub(positions[face[2]], positions[face[0]]));
+				const double length = std::sqrt(Dot(normal, normal));
+
+				if (length > 0)
+				{
+					const Vec3 n = { normal[0] / length, normal[1] / length, normal[2] / length };
+					quadrics[v].AddPlane(n[0], n[1], n[2], -Dot(n, positions[face[0]]), length / 2);
+				}
+
+				for (std::uint32_t w : face)
+				{
+					if (w != v)
+						ring.push_back(w);
+				}
+			}
+
+			//Every edge of a closed manifold is shared by two faces, the border and non manifold edges stay
+			std::sort(ring.begin(), ring.end());
+			for (std::size_t i = 0; i < ring.size();)
+			{
+				std::size_t j = i;
+				while (j < ring.size() && ring[j] == ring[i])
+					++j;
+
+				fixed[v] |= (j - i) != 2;
+				i = j;
+			}
+		}
+	});
+
+	if (pool.Cancelled())
+		return false;
+
+	std::size_t faceCount = faces.size();
+	std::size_t goal = targetFaces > 0 ? (faceCount > targetFaces ? faceCount - targetFaces : 0) : std::numeric_limits<std::size_t>::max();
+	const double maxCost = maxError > 0 ? maxError * maxError : 0;
+
+	Vec3 minCorner = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+	Vec3 maxCorner = { std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+
+	for (const Vec3& position : positions)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			minCorner[axis] = std::min(minCorner[axis], position[axis]);
+			maxCorner[axis] = std::max(maxCorner[axis], position[axis]);
+		}
+	}
+
+	const double extent = std::max(std::max(maxCorner[0] - minCorner[0], maxCorner[1] - minCorner[1]), maxCorner[2] - minCorner[2]);
+	const double size = extent / std::max(blocksPerAxis, 1) * (1 + 1e-9);
+
+	std::vector<std::vector<std::uint32_t>> blockVertices;
+
+	//Two parallel passes, the second with blocks shifted by half so the first pass's borders are inside a block
+	for (int pass = 0; pass < 2 && goal > 0; ++pass)
+	{
+		AssignBlocks(minCorner, size, blocksPerAxis, pass * size / 2, blockVertices, pool);
+
+		//Every block removes its share of the faces left to remove
+		std::vector<std::size_t> blockFaces(blockVertices.size(), 0);
+		for (std::size_t f = 0; f < faces.size(); ++f)
+		{
+			if (faceAlive[f])
+				++blockFaces[block[faces[f][0]]];
+		}
+
+		const double fraction = goal == std::numeric_limits<std::size_t>::max() ? 1.0 : static_cast<double>(goal) / faceCount;
+		std::vector<std::size_t> removed(blockVertices.size(), 0);
+
+		pool.ParallelFor(blockVertices.size(), 1, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t b = begin; b < end; ++b)
+			{
+				//An interior collapse removes two faces, an even share cannot overshoot
+				const std::size_t blockGoal = goal == std::numeric_limits<std::size_t>::max() ? goal :
+					static_cast<std::size_t>(blockFaces[b] * fraction) & ~static_cast<std::size_t>(1);
+
+				removed[b] = DecimateBlock(blockVertices[b], blockGoal, maxCost, pool);
+			}
+		});
+
+		if (pool.Cancelled())
+			return false;
+
+		for (std::size_t count : removed)
+		{
+			faceCount -= count;
+			if (goal != std::numeric_limits<std::size_t>::max())
+				goal -= std::min(goal, count);
+		}
+
+		progress((pass + 1) / 3.0f);
+	}
+
+	//Whatever the locked borders held back, in one block
+	if (goal > 0)
+	{
+		AssignBlocks(minCorner, 0, 1, 0, blockVertices, pool);
+		DecimateBlock(blockVertices[0], goal, maxCost, pool);
+	}
+
+	if (pool.Cancelled())
+		return false;
+
+	Store(mesh);
+	progress(1);
+
+	return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+//Quadric error metric edge collapse (Garland and Heckbert 1997) on an indexed mesh
+//The mesh is split into blocks that are decimated at once, vertices whose ring reaches another block are locked
+//Two block passes with shifted blocks let the borders move, a last serial pass reaches the exact target
+class MeshDecimator
+{
+	//Symmetric 4x4 error matrix, a00 a01 a02 a03 a11 a12 a13 a22 a23 a33, and the summed plane weights
+	struct Quadric
+	{
+		double a[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+		double weight = 0;
+
+		void AddPlane(double nx, double ny, double nz, double d, double weight);
+		void Add(const Quadric& other);
+		double Error(const std::array<double, 3>& p) const;
+
+		//Weighted mean squared distance to the planes
+		double MeanError(const std::array<double, 3>& p) const;
+
+		//Position with the smallest error, false if the matrix is singular
+		bool Minimum(std::array<double, 3>& p) const;
+	};
+
+	std::vector<std::array<double, 3>> positions;
+	std::vector<Quadric> quadrics;
+	std::vector<std::vector<std::uint32_t>> vertexFaces;
+	std::vector<std::uint32_t> stamps;
+	std::vector<char> vertexAlive;
+
+	std::vector<std::array<std::uint32_t, 3>> faces;
+	std::vector<char> faceAlive;
+
+	//On the mesh border or a non manifold edge, never collapsed
+	std::vector<char> fixed;
+
+	//Block of every vertex for the current pass and whether its ring leaves the block
+	std::vector<std::uint32_t> block;
+	std::vector<char> locked;
+
+	//A possible collapse, valid while both stamps match
+	struct Candidate
+	{
+		double cost;
+		std::uint32_t from;
+		std::uint32_t to;
+		std::uint32_t fromStamp;
+		std::uint32_t toStamp;
+		std::array<double, 3> position;
+
+		bool operator<(const Candidate& other) const;
+	};
+
+	//1 for an equilateral face, 0 for a line
+	double Compactness(const std::array<std::uint32_t, 3>& face) const;
+
+	bool MakeCandidate(std::uint32_t from, std::uint32_t to, Candidate& candidate) const;
+
+	//Link condition and no flipped or degenerate faces around the edge
+	bool CanCollapse(const Candidate& candidate) const;
+
+	//Moves to onto the candidate's position and removes from, returns the faces removed
+	std::size_t Collapse(const Candidate& candidate);
+
+	//Collapses edges of one block until removeGoal faces are gone or the error bound is reached
+	std::size_t DecimateBlock(const std::vector<std::uint32_t>& vertices, std::size_t removeGoal, double maxCost, const ThreadPool& pool);
+
+	//Assigns blocks of the given size shifted by offset, 1 block when size is 0
+	void AssignBlocks(const std::array<double, 3>& origin, double size, int count, double offset, std::vector<std::vector<std::uint32_t>>& blockVertices, ThreadPool& pool);
+
+	void Load(const IndexedMesh& mesh);
+	void Store(IndexedMesh& mesh) const;
+
+public:
+
+	//Faces to keep, 0 = only the error bound stops
+	std::size_t targetFaces = 0;
+
+	//Biggest distance error of a collapse, 0 = no bound
+	double maxError = 0;
+
+	//Blocks per axis of the parallel passes, fixed so the result does not depend on the thread count
+	int blocksPerAxis = 4;
+
+	//Returns false if cancelled, mesh is left as it was
+	bool Decimate(IndexedMesh& mesh, ThreadPool& pool, const std::function<void(float)>& progress);
+};
@@ -1,166 +1,1625 @@
 #include "MeshGenerator.h"
 
-#include <CGAL/remove_outliers.h>
-#include <CGAL/pca_estimate_normals.h>
-#include <CGAL/grid_simplify_point_set.h>
+#include <CGAL/Advancing_front_surface_reconstruction.h>
+#include <CGAL/Default_diagonalize_traits.h>
 #include <CGAL/hierarchy_simplify_point_set.h>
-#include <CGAL/jet_smooth_point_set.h>
 #include <CGAL/mst_orient_normals.h>
-#include <CGAL/bilateral_smooth_point_set.h>
+#include <CGAL/linear_least_squares_fitting_3.h>
+#include <CGAL/Monge_via_jet_fitting.h>
 #include <CGAL/Implicit_surface_3.h>
 #include <CGAL/Surface_mesh_default_triangulation_3.h>
-#include <CGAL/Polyhedron_3.h>
 #include <CGAL/make_surface_mesh.h>
 #include <CGAL/Poisson_reconstruction_function.h>
-#include <CGAL/IO/facets_in_complex_2_to_triangle_mesh.h>
+#include <CGAL/Handle_hash_function.h>
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <stack>
+#include <unordered_map>
 
+#include "BilateralSmoother.h"
 #include "Camera.h"
+#include "ColorTransfer.h"
 #include "Exporter.h"
 #include "imgui.h"
-#include "Obj_Writer.h"
+#include "MeshDecimator.h"
+#include "PoissonSolver.h"
+#include "SurfaceExtractor.h"
+#include "TextureBaker.h"
+#include "TiledProcessor.h"
 
+//Implicit_surface_3 keeps its function as a std::function, the solvers share this type
 typedef CGAL::Implicit_surface_3<Kernel, CGAL::Poisson_reconstruction_function<Kernel>> Surface_3;
 typedef CGAL::Surface_mesh_default_triangulation_3 STr;
 typedef CGAL::Surface_mesh_complex_2_in_triangulation_3<STr> C2t3;
 
-void MeshGenerator::RemoveOutliers()
-{	
-	//remove outliers
-	combinedModel.points.erase(remove_outliers(combinedModel.points,
-			numberOfNeighbors,
-			CGAL::parameters::threshold_percent(100.) // No limit on the number of points that can be removed
-			.threshold_distance(averageSpacing * 2)
-			.number_of_iterations(3)
-			.point_map(PointMap())),
-		combinedModel.points.end());
+//Points the tiled run measures the average spacing at
+#define SPACING_SAMPLES 100000
+
+void MeshGenerator::FilterViewConsistency(StageTarget& target)
+{
+	//A point that another camera sees clearly in front of the surface that camera measured lies in free space
+	//Points are checked against every shot's depth image instead of searching their 3D neighbors
+	if (!target.model.shotGrids || target.model.shotGrids->empty())
+		return;
+
+	const std::vector<ShotGrid>& grids = *target.model.shotGrids;
+	const float tolerance = consistencyTolerance * 1000.0f;
+	std::vector<char> remove(target.model.points.size(), 0);
+
+	StageFor(target, target.model.points.size(), [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const int shot = ShotIndex(target.model.points[i]);
+			int violations = 0;
+
+			for (int j = 0; j < static_cast<int>(grids.size()) && violations < consistencyViolations; ++j)
+			{
+				const ShotGrid& grid = grids[j];
+				if (j == shot || grid.depth.empty())
+					continue;
+
+				//Back into the camera space of shot j
+				const Point local = PointModel::RotatePoint(std::get<0>(target.model.points[i]), grid.center, -grid.turn);
+				const glm::vec3 position(local.x(), local.y(), local.z());
+
+				int x, y;
+				if (!grid.Project(position, x, y))
+					continue;
+
+				//The closest reading around the pixel, so edges and rounding do not count against the point
+				std::uint16_t closest = 0;
+				for (int py = std::max(y - 1, 0); py <= std::min(y + 1, grid.height - 1); ++py)
+				{
+					for (int px = std::max(x - 1, 0); px <= std::min(x + 1, grid.width - 1); ++px)
+					{
+						const std::uint16_t depth = grid.depth[px + py * grid.width];
+						if (depth > 0 && (closest == 0 || depth < closest))
+							closest = depth;
+					}
+				}
+
+				if (closest > 0 && position.z * 1000.0f < closest - tolerance)
+					++violations;
+			}
+
+			remove[i] = violations >= consistencyViolations;
+		}
+	});
+
+	//Skipped chunks left points unchecked, the run throws this stage away
+	if (cancelRequested)
+		return;
+
+	std::size_t out = 0;
+	for (std::size_t i = 0; i < target.model.points.size(); ++i)
+	{
+		if (!remove[i])
+			target.model.points[out++] = std::move(target.model.points[i]);
+	}
+	target.model.points.resize(out);
+
+	PointsChanged(target);
+}
+
+void MeshGenerator::ThinOverlap(StageTarget& target)
+{
+	//Neighboring shots see the same surface, each patch keeps only the points of the shot that saw it best
+	//A shot sees a point better the more head on it looks at it and the closer it is, depth noise grows with distance squared
+	const std::vector<Point>& viewpoints = target.model.viewpoints;
+	std::vector<PointWithData>& points = target.model.points;
+
+	if (viewpoints.empty() || points.empty() || overlapCellSize <= 0)
+		return;
+
+	struct Observation
+	{
+		float score;
+		int shot;
+	};
+
+	std::vector<CellKey> keys(points.size());
+	std::vector<Observation> observations(points.size());
+
+	StageFor(target, points.size(), [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const Point& position = std::get<0>(points[i]);
+			const Vector& normal = std::get<2>(points[i]);
+			const int shot = ShotIndex(points[i]);
+
+			keys[i] = GetCellKey(position, overlapCellSize);
+
+			//Opposite sides of a thin part share cells, the main axis of the normal keeps them apart
+			int axis = 0;
+			for (int a = 1; a < 3; ++a)
+			{
+				if (std::abs(normal[a]) > std::abs(normal[axis]))
+					axis = a;
+			}
+			keys[i][0] = keys[i][0] * 6 + axis * 2 + (normal[axis] < 0);
+
+			if (shot < 0 || shot >= static_cast<int>(viewpoints.size()) || normal.squared_length() == 0)
+			{
+				//Nothing to compare against, the point stays
+				observations[i] = { -1, shot };
+				continue;
+			}
+
+			const Vector view = viewpoints[shot] - position;
+			const double sqDistance = view.squared_length();
+			const double incidence = std::abs(normal * view) / std::sqrt(normal.squared_length() * sqDistance);
+
+			observations[i] = { static_cast<float>(incidence / std::max(sqDistance, 1e-6)), shot };
+		}
+	});
+
+	if (cancelRequested)
+		return;
+
+	//Best shot per cell, found per chunk and then merged, ties go to the lower shot so the result does not depend on the chunks
+	typedef std::unordered_map<CellKey, Observation, CellKeyHash> BestMap;
+	const std::size_t chunks = ThreadPool::ChunkCount(points.size(), PARALLEL_GRAIN);
+	std::vector<BestMap> chunkBest(chunks);
+
+	auto better = [](const Observation& a, const Observation& b)
+	{
+		return a.score > b.score || (a.score == b.score && a.shot < b.shot);
+	};
+
+	threadPool.ParallelFor(points.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		BestMap& best = chunkBest[begin / PARALLEL_GRAIN];
+		best.reserve(end - begin);
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			if (observations[i].score < 0)
+				continue;
+
+			const auto found = best.emplace(keys[i], observations[i]);
+			if (!found.second && better(observations[i], found.first->second))
+				found.first->second = observations[i];
+		}
+	});
+
+	if (cancelRequested)
+		return;
+
+	BestMap best = std::move(chunkBest[0]);
+	for (std::size_t chunk = 1; chunk < chunks; ++chunk)
+	{
+		for (const auto& cell : chunkBest[chunk])
+		{
+			const auto found = best.insert(cell);
+			if (!found.second && better(cell.second, found.first->second))
+				found.first->second = cell.second;
+		}
+		chunkBest[chunk] = BestMap();
+	}
+
+	std::vector<char> remove(points.size(), 0);
+
+	threadPool.ParallelFor(points.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			if (observations[i].score >= 0)
+				remove[i] = best.find(keys[i])->second.shot != observations[i].shot;
+		}
+	});
+
+	if (cancelRequested)
+		return;
+
+	std::size_t out = 0;
+	for (std::size_t i = 0; i < points.size(); ++i)
+	{
+		if (!remove[i])
+			points[out++] = std::move(points[i]);
+	}
+	points.resize(out);
+
+	PointsChanged(target);
+}
+
+void MeshGenerator::RemoveOutliers(StageTarget& target)
+{
+	//Same criteria as CGAL::remove_outliers with threshold_percent 100, only the distance is used
+	target.neighbors.Prepare(target.model.points, target.version, numberOfNeighbors, threadPool);
+
+	const FT threshold = target.averageSpacing * 2;
+	std::vector<char> remove(target.model.points.size(), 0);
+
+	StageFor(target, target.model.points.size(), [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const std::uint32_t* list = target.neighbors.Neighbors(i);
+
+			FT sqDistance = 0;
+			for (int n = 0; n <= numberOfNeighbors; ++n)
+				sqDistance += CGAL::squared_distance(target.neighbors.Position(i), target.neighbors.Position(list[n]));
+			sqDistance /= numberOfNeighbors + 1;
+
+			remove[i] = sqDistance >= threshold * threshold;
+		}
+	});
+
+	std::size_t out = 0;
+	for (std::size_t i = 0; i < target.model.points.size(); ++i)
+	{
+		if (!remove[i])
+			target.model.points[out++] = std::move(target.model.points[i]);
+	}
+	target.model.points.resize(out);
+
+	PointsChanged(target);
+}
+
+void MeshGenerator::GridSimplify(StageTarget& target)
+{
+	//One linear pass, the occupied cells are found per chunk in parallel and merged in chunk order
+	//Cells come out in the order of their first point like CGAL::grid_simplify_point_set keeps them
+	std::vector<PointWithData>& points = target.model.points;
+	const std::size_t chunks = ThreadPool::ChunkCount(points.size(), PARALLEL_GRAIN);
+
+	struct Cell
+	{
+		CellKey key;
+		double position[3];
+		double normal[3];
+		std::uint32_t color[3];
+		std::uint32_t count;
+		std::size_t first;
+	};
+
+	std::vector<std::vector<Cell>> chunkCells(chunks);
+
+	//Cell of every point, the chunk's own index until the merge
+	std::vector<std::uint32_t> cellOf(points.size());
+
+	StageFor(target, points.size(), [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<Cell>& cells = chunkCells[begin / PARALLEL_GRAIN];
+		std::unordered_map<CellKey, std::uint32_t, CellKeyHash> lookup;
+		lookup.reserve(end - begin);
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const Point& position = std::get<0>(points[i]);
+			const CellKey key = GetCellKey(position, gridCellSize);
+
+			const auto found = lookup.emplace(key, static_cast<std::uint32_t>(cells.size()));
+			if (found.second)
+				cells.push_back({ key, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, 0, i });
+
+			Cell& cell = cells[found.first->second];
+			const Color& color = std::get<1>(points[i]);
+			const Vector& normal = std::get<2>(points[i]);
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				cell.position[axis] += position[axis];
+				cell.normal[axis] += normal[axis];
+				cell.color[axis] += color[axis];
+			}
+			++cell.count;
+
+			cellOf[i] = found.first->second;
+		}
+	});
+
+	//Skipped chunks left cells out, the run throws this stage away
+	if (cancelRequested)
+		return;
+
+	std::unordered_map<CellKey, std::uint32_t, CellKeyHash> lookup;
+	std::vector<Cell> cells;
+	std::vector<std::vector<std::uint32_t>> remap(chunks);
+
+	lookup.reserve(chunkCells.empty() ? 0 : chunkCells[0].size() * chunks);
+
+	for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		remap[chunk].resize(chunkCells[chunk].size());
+
+		for (std::size_t local = 0; local < chunkCells[chunk].size(); ++local)
+		{
+			const Cell& cell = chunkCells[chunk][local];
+			const auto found = lookup.emplace(cell.key, static_cast<std::uint32_t>(cells.size()));
+
+			if (found.second)
+				cells.push_back(cell);
+			else
+			{
+				Cell& merged = cells[found.first->second];
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					merged.position[axis] += cell.position[axis];
+					merged.normal[axis] += cell.normal[axis];
+					merged.color[axis] += cell.color[axis];
+				}
+				merged.count += cell.count;
+			}
+
+			remap[chunk][local] = found.first->second;
+		}
+
+		chunkCells[chunk] = {};
+	}
+
+	lookup = {};
+
+	std::vector<PointWithData> simplified(cells.size());
+
+	if (gridMode == GridMode::Centroid)
+	{
+		threadPool.ParallelFor(points.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t i = begin; i < end; ++i)
+				cellOf[i] = remap[begin / PARALLEL_GRAIN][cellOf[i]];
+		});
+
+		//Real sample closest to its cell's centroid, lowest index on ties
+		std::vector<std::size_t> nearest(cells.size());
+		std::vector<double> nearestDistance(cells.size(), std::numeric_limits<double>::max());
+
+		for (std::size_t i = 0; i < points.size(); ++i)
+		{
+			const Cell& cell = cells[cellOf[i]];
+			const Point& position = std::get<0>(points[i]);
+
+			double distance = 0;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const double offset = position[axis] - cell.position[axis] / cell.count;
+				distance += offset * offset;
+			}
+
+			if (distance < nearestDistance[cellOf[i]])
+			{
+				nearestDistance[cellOf[i]] = distance;
+				nearest[cellOf[i]] = i;
+			}
+		}
+
+		threadPool.ParallelFor(cells.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t c = begin; c < end; ++c)
+				simplified[c] = points[nearest[c]];
+		});
+	}
+	else
+	{
+		threadPool.ParallelFor(cells.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t c = begin; c < end; ++c)
+			{
+				const Cell& cell = cells[c];
+				simplified[c] = points[cell.first];
+
+				if (gridMode != GridMode::Average)
+					continue;
+
+				std::get<0>(simplified[c]) = Point(
+					cell.position[0] / cell.count,
+					cell.position[1] / cell.count,
+					cell.position[2] / cell.count);
+
+				std::get<1>(simplified[c]) = {
+					static_cast<unsigned char>((cell.color[0] + cell.count / 2) / cell.count),
+					static_cast<unsigned char>((cell.color[1] + cell.count / 2) / cell.count),
+					static_cast<unsigned char>((cell.color[2] + cell.count / 2) / cell.count) };
+
+				//Normals that cancel out stay null so they get estimated later
+				const Vector normal(cell.normal[0], cell.normal[1], cell.normal[2]);
+				const double length = std::sqrt(normal.squared_length());
+				std::get<2>(simplified[c]) = length > 0 ? normal / length : Vector(0, 0, 0);
+			}
+		});
+	}
+
+	points = std::move(simplified);
+
+	PointsChanged(target);
 }
 
-void MeshGenerator::GridSimplify()
-{
-	combinedModel.points.erase(
-		CGAL::grid_simplify_point_set(combinedModel.points,
-			gridCellSize,
-			CGAL::parameters::point_map(PointMap())),
-		combinedModel.points.end());
+void MeshGenerator::HierarchySimplify(StageTarget& target)
+{
+	target.model.points.erase(
+		CGAL::hierarchy_simplify_point_set(
+			target.model.points,
+			CGAL::parameters::size(maxClusterSize)
+			.maximum_variation(maxSurfaceVariation)
+			.point_map(PointMap())
+			.callback([&](double done)
+			{
+				if (target.reportProgress)
+					progress = static_cast<float>(done);
+				return !cancelRequested;
+			})),
+		target.model.points.end());
+
+	PointsChanged(target);
+}
+
+void MeshGenerator::WlopSimplify(StageTarget& target)
+{
+	//Weighted locally optimal projection, the same steps as CGAL::wlop_simplify_and_regularize_point_set
+	//Samples are moved independently within an iteration, so every iteration runs on the thread pool
+	std::vector<PointWithData>& points = target.model.points;
+	if (points.empty())
+		return;
+
+	const std::size_t sampleCount = std::min(points.size(), static_cast<std::size_t>(std::max(wlopTargetCount, 1)));
+	const double radius = wlopRadius * target.averageSpacing;
+	const double weightScale = -4.0 / (radius * radius);
+
+	std::vector<Point> positions(points.size());
+	threadPool.ParallelFor(positions.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+			positions[i] = std::get<0>(points[i]);
+	});
+
+	//Voxels about the size of the radius, a scan holds about wlopRadius^2 points per voxel
+	KnnGrid grid;
+	grid.pointsPerCell = std::max(8.0f, wlopRadius * wlopRadius);
+	grid.Build(positions, threadPool);
+
+	//Evenly strided input points instead of CGAL's random shuffle, so runs repeat
+	std::vector<Point> samples(sampleCount);
+	for (std::size_t s = 0; s < sampleCount; ++s)
+		samples[s] = positions[s * points.size() / sampleCount];
+
+	std::vector<Point> updated(sampleCount);
+	std::vector<double> density(sampleCount);
+
+	for (int iteration = 0; iteration < wlopIterations; ++iteration)
+	{
+		KnnGrid sampleGrid;
+		sampleGrid.pointsPerCell = std::max(1.0f, grid.pointsPerCell * sampleCount / points.size());
+		sampleGrid.Build(samples, threadPool);
+
+		//Samples in crowded areas push their neighbors harder
+		threadPool.ParallelFor(sampleCount, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			std::vector<std::uint32_t> neighbors;
+
+			for (std::size_t s = begin; s < end; ++s)
+			{
+				sampleGrid.QueryRadius(samples[s], static_cast<float>(radius), neighbors);
+
+				density[s] = 1;
+				for (std::uint32_t n : neighbors)
+					density[s] += std::exp(CGAL::squared_distance(samples[s], samples[n]) * weightScale);
+			}
+		});
+
+		std::atomic<std::size_t> done{ 0 };
+
+		threadPool.ParallelFor(sampleCount, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			std::vector<std::uint32_t> neighbors;
+
+			for (std::size_t s = begin; s < end; ++s)
+			{
+				const Point& query = samples[s];
+
+				//Attraction to the weighted average of the input points around the sample
+				grid.QueryRadius(query, static_cast<float>(radius), neighbors);
+
+				Vector average = CGAL::NULL_VECTOR;
+				double averageWeight = 0;
+
+				for (std::uint32_t n : neighbors)
+				{
+					const double distance = CGAL::squared_distance(query, positions[n]);
+					if (distance < 1e-10)
+						continue;
+
+					const double weight = std::exp(distance * weightScale);
+					average = average + (positions[n] - CGAL::ORIGIN) * weight;
+					averageWeight += weight;
+				}
+
+				average = averageWeight < 1e-10 ? query - CGAL::ORIGIN : average / averageWeight;
+
+				//Repulsion from the other samples keeps them evenly spread
+				sampleGrid.QueryRadius(query, static_cast<float>(radius), neighbors);
+
+				Vector repulsion = CGAL::NULL_VECTOR;
+				double repulsionWeight = 0;
+
+				for (std::uint32_t n : neighbors)
+				{
+					const double distance = CGAL::squared_distance(query, samples[n]);
+					if (distance < 1e-10)
+						continue;
+
+					const double weight = std::exp(distance * weightScale) / distance * density[n];
+					repulsion = repulsion + (query - samples[n]) * weight;
+					repulsionWeight += weight;
+				}
+
+				if (neighbors.size() < 3 || repulsionWeight < 1e-10)
+					repulsion = CGAL::NULL_VECTOR;
+				else
+					repulsion = repulsion / repulsionWeight;
+
+				updated[s] = CGAL::ORIGIN + average + 0.45 * repulsion;
+			}
+
+			if (target.reportProgress)
+				progress = (iteration + static_cast<float>(done += end - begin) / sampleCount) / wlopIterations;
+		});
+
+		//Skipped chunks left samples unmoved, the run throws this stage away
+		if (cancelRequested)
+			return;
+
+		samples.swap(updated);
+	}
+
+	//WLOP only outputs positions, color, normal and shot come from the closest input point
+	std::vector<PointWithData> result(sampleCount);
+
+	threadPool.ParallelFor(sampleCount, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<std::uint32_t> closest;
+
+		for (std::size_t s = begin; s < end; ++s)
+		{
+			grid.Query(samples[s], 1, closest);
+
+			result[s] = points[closest.empty() ? 0 : closest[0]];
+			std::get<0>(result[s]) = samples[s];
+		}
+	});
+
+	points = std::move(result);
+
+	PointsChanged(target);
+}
+
+void MeshGenerator::EstimateNormals(StageTarget& target, bool missingOnly)
+{
+	//Same as CGAL::pca_estimate_normals with a neighbor radius, using the shared lists
+	const unsigned int k = 24;
+	target.neighbors.Prepare(target.model.points, target.version, k, threadPool);
+
+	const FT sqRadius = (2 * target.averageSpacing) * (2 * target.averageSpacing);
+
+	StageFor(target, target.model.points.size(), [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<Point> neighborhood;
+		neighborhood.reserve(k + 1);
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			if (missingOnly && std::get<2>(target.model.points[i]).squared_length() > 0)
+				continue;
+
+			const std::uint32_t* list = target.neighbors.Neighbors(i);
+			const Point& query = target.neighbors.Position(i);
+
+			neighborhood.clear();
+			for (unsigned int n = 0; n <= k; ++n)
+			{
+				//No spacing yet means plain k nearest neighbors
+				if (target.averageSpacing <= 0 || CGAL::squared_distance(query, target.neighbors.Position(list[n])) <= sqRadius)
+					neighborhood.push_back(target.neighbors.Position(list[n]));
+			}
+
+			//Not enough points in the radius, fall back to the closest ones
+			if (neighborhood.size() < 3)
+			{
+				neighborhood.clear();
+				for (unsigned int n = 0; n <= 3; ++n)
+					neighborhood.push_back(target.neighbors.Position(list[n]));
+			}
+
+			Kernel::Plane_3 plane;
+			CGAL::linear_least_squares_fitting_3(neighborhood.begin(), neighborhood.end(), plane, CGAL::Dimension_tag<0>());
+
+			//Unit length like pca_estimate_normals
+			const Vector normal = plane.orthogonal_vector();
+			std::get<2>(target.model.points[i]) = normal / std::sqrt(normal.squared_length());
+		}
+	});
+}
+
+void MeshGenerator::GenerateNormals(StageTarget& target)
+{
+	//Generate normals
+	//Shots already come with normals from their depth grid, only the pixels without one are estimated
+	EstimateNormals(target, useShotNormals);
+
+	//Orient normals
+	if (normalOrientation == NormalOrientation::Viewpoint && !target.model.viewpoints.empty())
+	{
+		OrientTowardViewpoints(target);
+		return;
+	}
+
+	//Delete normals that cannot be oriented
+	/*
+	 * Normals that cannot be oriented need to be deleted for better mesh generation
+	 */
+	target.model.points.erase(
+		CGAL::mst_orient_normals(
+			target.model.points,
+			24,
+			CGAL::parameters::point_map(PointMap())
+			.normal_map(NormalMap())),
+		target.model.points.end());
+
+	PointsChanged(target);
+}
+
+void MeshGenerator::OrientTowardViewpoints(StageTarget& target)
+{
+	//The surface was seen from the shot's camera, so its normal faces that camera
+	const std::vector<Point>& viewpoints = target.model.viewpoints;
+
+	StageFor(target, target.model.points.size(), [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			PointWithData& point = target.model.points[i];
+			const int shot = ShotIndex(point);
+
+			//Unknown shot, keep the normal as it is
+			if (shot < 0 || shot >= static_cast<int>(viewpoints.size()))
+				continue;
+
+			Vector& normal = std::get<2>(point);
+			if (normal * (viewpoints[shot] - std::get<0>(point)) < 0)
+				normal = -normal;
+		}
+	});
+}
+
+void MeshGenerator::JetSmooth(StageTarget& target)
+{
+	//Same as CGAL::jet_smooth_point_set, using the shared lists
+	typedef CGAL::Monge_via_jet_fitting<Kernel> MongeFitting;
+
+	target.neighbors.Prepare(target.model.points, target.version, jetNeighbors, threadPool);
+
+	//Reads the cached positions and writes the model, so every point sees the unsmoothed cloud
+	StageFor(target, target.model.points.size(), [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<Point> neighborhood(jetNeighbors + 1);
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const std::uint32_t* list = target.neighbors.Neighbors(i);
+
+			for (int n = 0; n <= jetNeighbors; ++n)
+				neighborhood[n] = target.neighbors.Position(list[n]);
+
+			MongeFitting fitting;
+			std::get<0>(target.model.points[i]) = fitting(neighborhood.begin(), neighborhood.end(), 2, 2).origin();
+		}
+	});
+
+	//Jet smoothing only moves points slightly, keep the neighborhoods
+	target.neighbors.PointsMoved(target.model.points, target.version, target.averageSpacing, threadPool);
+}
+
+void MeshGenerator::SmoothPoints(StageTarget& target)
+{
+	//Shot normals face their camera, without them smooth with unoriented PCA normals
+	const bool hasNormals = useShotNormals && std::all_of(target.model.points.begin(), target.model.points.end(),
+		[](const PointWithData& point) { return std::get<2>(point).squared_length() > 0; });
+
+	if (!hasNormals)
+		EstimateNormals(target, useShotNormals);
+
+	//Neighborhoods are found once, the iterations reuse them
+	target.neighbors.Prepare(target.model.points, target.version, neighborhoodSize, threadPool);
+
+	BilateralSmoother smoother;
+	smoother.sharpnessAngle = angleSharpness;
+	smoother.orientedNormals = hasNormals;
+
+	smoother.Smooth(target.model.points, target.neighbors, neighborhoodSize,
+		smoothingIterations, smoothingStop * target.averageSpacing, threadPool,
+		[&](int iteration, float displacement)
+		{
+			if (!target.reportProgress)
+				return;
+
+			progress = static_cast<float>(iteration) / smoothingIterations;
+			SetStatus("Smoothing " + std::to_string(iteration) + "/" + std::to_string(smoothingIterations) +
+				", moved " + std::to_string(displacement));
+		});
+
+	target.neighbors.PointsMoved(target.model.points, target.version, target.averageSpacing, threadPool);
+}
+
+void MeshGenerator::ComputeAverageSpacing(StageTarget& target)
+{
+	target.neighbors.Prepare(target.model.points, target.version, numberOfNeighbors, threadPool);
+	target.averageSpacing = target.neighbors.AverageSpacing(numberOfNeighbors, threadPool);
+}
+
+void MeshGenerator::PointsChanged(StageTarget& target)
+{
+	++target.version;
+}
+
+MeshGenerator::StageTarget MeshGenerator::CombinedTarget()
+{
+	return { combinedModel, neighborCache, modelVersion, averageSpacing, true };
+}
+
+void MeshGenerator::StageFor(const StageTarget& target, std::size_t count, const std::function<void(std::size_t, std::size_t)>& func)
+{
+	if (!target.reportProgress)
+	{
+		threadPool.ParallelFor(count, PARALLEL_GRAIN, func);
+		return;
+	}
+
+	std::atomic<std::size_t> done{ 0 };
+	progress = 0;
+
+	threadPool.ParallelFor(count, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		func(begin, end);
+		progress = static_cast<float>(done += end - begin) / count;
+	});
+}
+
+void MeshGenerator::BeginRun()
+{
+	cancelRequested = false;
+	progress = 0;
+
+	threadPool.SetThreadCount(threadCount);
+	threadPool.SetCancelFlag(&cancelRequested);
+}
+
+bool MeshGenerator::AbortRun()
+{
+	//Stages stopped half way, nothing they left behind can be trusted
+	//The rest of the model does not change while processing, the points are taken from the snapshot again when needed
+	if (std::atomic_load(&snapshot))
+	{
+		combinedModel.points.clear();
+		pointsPublished = true;
+	}
+	else
+	{
+		combinedModel = PointModel();
+		pointsPublished = false;
+	}
+
+	neighborCache.Clear();
+	++modelVersion;
+
+	SetStatus("Cancelled");
+	return false;
+}
+
+//Same walk as CGAL::facets_in_complex_2_to_triangle_mesh, straight into flat arrays instead of a halfedge structure
+//The facets are oriented consistently from neighbor to neighbor, then the whole mesh so the highest facet faces +Z
+static void ComplexToMesh(const C2t3& c2t3, IndexedMesh& mesh)
+{
+	typedef STr::Vertex_handle Vertex_handle;
+	typedef STr::Facet Facet;
+	typedef STr::Edge Edge;
+
+	const STr& tr = c2t3.triangulation();
+	const std::size_t facetCount = c2t3.number_of_facets();
+
+	mesh.Clear();
+	if (facetCount == 0)
+		return;
+
+	std::set<Facet> oriented;
+	std::vector<Facet> order;
+	std::stack<Facet> stack;
+	order.reserve(facetCount);
+
+	auto finite = tr.finite_facets_begin();
+
+	while (oriented.size() != facetCount)
+	{
+		while (!finite->first->is_facet_on_surface(finite->second) ||
+			oriented.count(*finite) ||
+			oriented.count(c2t3.opposite_facet(*finite)))
+			++finite;
+
+		oriented.insert(*finite);
+		order.push_back(*finite);
+		stack.push(*finite);
+
+		while (!stack.empty())
+		{
+			const Facet facet = stack.top();
+			stack.pop();
+
+			for (int edge = 0; edge < 3; ++edge)
+			{
+				const int i1 = tr.vertex_triple_index(facet.second, tr.cw(edge));
+				const int i2 = tr.vertex_triple_index(facet.second, tr.ccw(edge));
+
+				if (c2t3.face_status(Edge(facet.first, i1, i2)) != C2t3::REGULAR)
+					continue;
+
+				const Facet neighbor = c2t3.neighbor(facet, edge);
+				if (!oriented.count(neighbor) && !oriented.count(c2t3.opposite_facet(neighbor)))
+				{
+					oriented.insert(neighbor);
+					order.push_back(neighbor);
+					stack.push(neighbor);
+				}
+			}
+		}
+	}
+
+	auto corner = [&tr](const Facet& facet, int index) { return facet.first->vertex(tr.vertex_triple_index(facet.second, index)); };
+
+	//Orientation of the whole mesh from its highest facet
+	const Facet* top = &order.front();
+	double topZ = std::numeric_limits<double>::lowest();
+
+	for (const Facet& facet : order)
+	{
+		const double z = corner(facet, 0)->point().z() + corner(facet, 1)->point().z() + corner(facet, 2)->point().z();
+		if (z > topZ)
+		{
+			topZ = z;
+			top = &facet;
+		}
+	}
+
+	const Vector topNormal = CGAL::cross_product(
+		corner(*top, 1)->point() - corner(*top, 0)->point(),
+		corner(*top, 2)->point() - corner(*top, 1)->point());
+	const bool regular = topNormal.z() >= 0;
+
+	std::unordered_map<Vertex_handle, std::uint32_t, CGAL::Handle_hash_function> index;
+	index.reserve(tr.number_of_vertices());
+
+	auto vertexIndex = [&](Vertex_handle vertex)
+	{
+		const auto found = index.emplace(vertex, static_cast<std::uint32_t>(mesh.VertexCount()));
+		if (found.second)
+		{
+			const Point& point = vertex->point();
+			mesh.vertices.insert(mesh.vertices.end(), {
+				static_cast<float>(point.x()), static_cast<float>(point.y()), static_cast<float>(point.z()) });
+		}
+		return found.first->second;
+	};
+
+	mesh.vertices.reserve(tr.number_of_vertices() * 3);
+	mesh.triangles.reserve(facetCount * 3);
+
+	for (const Facet& facet : order)
+	{
+		mesh.triangles.push_back(vertexIndex(corner(facet, 0)));
+		mesh.triangles.push_back(vertexIndex(corner(facet, regular ? 1 : 2)));
+		mesh.triangles.push_back(vertexIndex(corner(facet, regular ? 2 : 1)));
+	}
+}
+
+bool MeshGenerator::GenerateMesh()
+{
+	BeginRun();
+
+	//Normals are added to the points, the published ones stay as they are
+	ReclaimPoints();
+	StageTarget target = CombinedTarget();
+
+	//Interpolating meshes use the points as they are, no normals or implicit function
+	if (meshMode != MeshMode::Poisson)
+		return GenerateInterpolatingMesh(target);
+
+	//Need to generate normals
+	SetStatus("Generating Normals");
+	GenerateNormals(target);
+
+	if (cancelRequested)
+		return AbortRun();
+	
+	//Gets the average spacing
+	SetStatus("Calculating average distance");
+	ComputeAverageSpacing(target);
+
+	if (cancelRequested)
+		return AbortRun();
+
+	//CGAL's Poisson solver and mesher cannot be interrupted, cancelling is checked between them
+	SetStatus("Generating Mesh");
+	progress = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	//Both solvers are negative inside, the mesher only sees them through this function
+	std::function<FT(Point)> implicitFunction;
+	Point inner_point;
+	FT sm_sphere_radius;
+
+	std::unique_ptr<CGAL::Poisson_reconstruction_function<Kernel>> possionFunction;
+	PoissonSolver screenedSolver;
+
+	//The clip box plus a margin, nothing outside it is solved or meshed
+	const bool bounded = boundDomain && combinedModel.clipped;
+	Point domainMin;
+	Point domainMax;
+	if (bounded)
+	{
+		const FT margin = domainMargin * averageSpacing;
+		domainMin = Point(combinedModel.clipMin.x() - margin, combinedModel.clipMin.y() - margin, combinedModel.clipMin.z() - margin);
+		domainMax = Point(combinedModel.clipMax.x() + margin, combinedModel.clipMax.y() + margin, combinedModel.clipMax.z() + margin);
+	}
+
+	if (meshSolver == MeshSolver::CGAL)
+	{
+		possionFunction = std::make_unique<CGAL::Poisson_reconstruction_function<Kernel>>(
+			combinedModel.points.begin(), combinedModel.points.end(),
+			PointMap(), NormalMap());
+
+		if (!possionFunction->compute_implicit_function())
+			return false;
+
+		implicitFunction = [&possionFunction](Point p) { return (*possionFunction)(p); };
+
+		// and computes implicit function bounding sphere radius.
+		inner_point = possionFunction->get_inner_point();
+		Sphere bsphere = possionFunction->bounding_sphere();
+		FT radius = std::sqrt(bsphere.squared_radius());
+		// Defines the implicit surface: requires defining a
+		// conservative bounding sphere centered at inner point.
+		sm_sphere_radius = 5.0 * radius;
+
+		if (bounded)
+		{
+			//Outside the domain the function is positive without being evaluated, growing with the distance to the box
+			implicitFunction = [&possionFunction, domainMin, domainMax](Point p)
+			{
+				FT outside = 0;
+				for (int axis = 0; axis < 3; ++axis)
+					outside = std::max(outside, std::max(domainMin[axis] - p[axis], p[axis] - domainMax[axis]));
+
+				return outside > 0 ? outside : (*possionFunction)(p);
+			};
+
+			//The surface cannot leave the domain, so a sphere holding the box holds the surface
+			FT boxRadius = 0;
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				const Point point(
+					(corner & 1) ? domainMax.x() : domainMin.x(),
+					((corner >> 1) & 1) ? domainMax.y() : domainMin.y(),
+					(corner >> 2) ? domainMax.z() : domainMin.z());
+
+				boxRadius = std::max(boxRadius, CGAL::squared_distance(inner_point, point));
+			}
+			sm_sphere_radius = std::min(sm_sphere_radius, std::sqrt(boxRadius));
+		}
+	}
+	else
+	{
+		SetStatus("Solving Screened Poisson");
+		screenedSolver.depth = solverDepth;
+		screenedSolver.screening = solverScreening;
+		screenedSolver.iterations = solverIterations;
+		screenedSolver.bounded = bounded;
+		screenedSolver.boundMin = domainMin;
+		screenedSolver.boundMax = domainMax;
+
+		if (!screenedSolver.Solve(combinedModel.points, averageSpacing, threadPool,
+			[this](float done) { progress = done * 0.5f; }))
+			return cancelRequested ? AbortRun() : false;
+
+		implicitFunction = [&screenedSolver](Point p) { return screenedSolver(p); };
+
+		//The solver's grid already holds the whole surface
+		inner_point = screenedSolver.GetInnerPoint();
+		sm_sphere_radius = std::sqrt(screenedSolver.GetBoundingSphere().squared_radius());
+
+		SetStatus("Generating Mesh");
+	}
+
+	const double solveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (cancelRequested)
+		return AbortRun();
+
+	progress = 0.5f;
+	start = std::chrono::steady_clock::now();
+
+	//Only the screened solver can be sampled from several threads, CGAL's function caches per cell data on first use
+	if (meshLevels > 1)
+		return GenerateLevels(implicitFunction, meshSolver == MeshSolver::Screened, inner_point, sm_sphere_radius, solveSeconds);
+
+	if (meshExtraction == MeshExtraction::SurfaceNets)
+	{
+		IndexedMesh mesh;
+		if (!ExtractSurfaceNets(implicitFunction, meshSolver == MeshSolver::Screened, mesh))
+			return cancelRequested ? AbortRun() : false;
+
+		const double meshSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		ReportMeshTimes(solveSeconds, meshSeconds, mesh.TriangleCount());
+
+		return FinishMesh(mesh);
+	}
+
+	IndexedMesh outMesh;
+	if (!MeshDelaunay(implicitFunction, inner_point, sm_sphere_radius, 1, outMesh))
+		return false;
+
+	if (cancelRequested)
+		return AbortRun();
+
+	const double meshSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	ReportMeshTimes(solveSeconds, meshSeconds, outMesh.TriangleCount());
+	
+	return FinishMesh(outMesh);
+}
+
+bool MeshGenerator::MeshDelaunay(const std::function<FT(Point)>& function, const Point& innerPoint, FT sphereRadius, FT scale, IndexedMesh& mesh)
+{
+	FT sm_dichotomy_error = distance * averageSpacing / 1000.0; // Dichotomy error must be << sm_distance
+	Surface_3 surface(function,
+		Sphere(innerPoint, sphereRadius * sphereRadius),
+		sm_dichotomy_error / sphereRadius);
+	// Defines surface mesh generation criteria
+	CGAL::Surface_mesh_default_criteria_3<STr> criteria(angle,  // Min triangle angle (degrees)
+		scale * this->radius * averageSpacing,  // Max triangle size
+		scale * distance * averageSpacing); // Approximation error
+// Generates surface mesh with manifold option
+	STr tr; // 3D Delaunay triangulation for surface mesh generation
+	C2t3 c2t3(tr); // 2D complex in 3D Delaunay triangulation
+	CGAL::make_surface_mesh(c2t3,                                 // reconstructed mesh
+		surface,                              // implicit surface
+		criteria,                             // meshing criteria
+		CGAL::Manifold_with_boundary_tag());  // require manifold mesh
+	
+	if (tr.number_of_vertices() == 0)
+		return false;
+
+	ComplexToMesh(c2t3, mesh);
+	return true;
+}
+
+bool MeshGenerator::GenerateLevels(const std::function<FT(Point)>& function, bool threadSafe, const Point& innerPoint, FT sphereRadius, double solveSeconds)
+{
+	//Level 0 uses the mesh settings, every further level doubles the cell size or the triangle size of the one before
+	const auto start = std::chrono::steady_clock::now();
+	const int levels = meshLevels;
+	std::vector<IndexedMesh> meshes(levels);
+	std::atomic<int> levelsDone{ 0 };
+
+	auto levelDone = [this, &levelsDone, levels]() { progress = 0.5f + 0.4f * static_cast<float>(++levelsDone) / levels; };
+
+	if (meshExtraction == MeshExtraction::SurfaceNets)
+	{
+		//The function is sampled once at the finest cell, coarser grids take every 2nd, 4th... node of it
+		std::vector<SurfaceExtractor> extractors(levels);
+		if (!SampleSurfaceNets(function, threadSafe, extractors[0]))
+			return cancelRequested ? AbortRun() : false;
+
+		SetStatus("Extracting " + std::to_string(levels) + " Levels");
+		for (int level = 1; level < levels; ++level)
+			extractors[level].Downsample(extractors[0], 1 << level, threadPool);
+
+		threadPool.ParallelFor(levels, 1, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t level = begin; level < end; ++level)
+			{
+				extractors[level].Extract(meshes[level], threadPool);
+				levelDone();
+			}
+		});
+	}
+	else
+	{
+		SetStatus("Meshing " + std::to_string(levels) + " Levels");
+
+		auto meshLevel = [&](int level)
+		{
+			MeshDelaunay(function, innerPoint, sphereRadius, static_cast<FT>(1 << level), meshes[level]);
+			levelDone();
+		};
+
+		//Every level refines its own triangulation, only the function is shared
+		if (threadSafe)
+		{
+			threadPool.ParallelFor(levels, 1, [&](std::size_t begin, std::size_t end)
+			{
+				for (std::size_t level = begin; level < end; ++level)
+					meshLevel(static_cast<int>(level));
+			});
+		}
+		else
+		{
+			for (int level = 0; level < levels && !cancelRequested; ++level)
+				meshLevel(level);
+		}
+	}
+
+	if (cancelRequested)
+		return AbortRun();
+
+	const double meshSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::ostringstream result;
+	result << (meshSolver == MeshSolver::CGAL ? "CGAL Poisson" : "Screened Poisson")
+		<< ": solve " << solveSeconds << " s, " << levels << " levels " << meshSeconds << " s\n";
+	for (int level = 0; level < levels; ++level)
+		result << "  LOD" << level << ": " << meshes[level].TriangleCount() << " triangles\n";
+	meshResult = result.str();
+
+	//Coarsest first, one file set per level
+	for (int level = levels - 1; level >= 0; --level)
+	{
+		if (meshes[level].TriangleCount() == 0)
+			continue;
+
+		if (!FinishMesh(meshes[level], "MeshOut_LOD" + std::to_string(level)))
+			return false;
+
+		meshes[level] = IndexedMesh();
+	}
+
+	return true;
+}
+
+void MeshGenerator::ScaleSpaceSmooth(StageTarget& target, std::vector<PointWithData>& scaled)
+{
+	//Same step as CGAL's Scale_space_reconstruction_3::Weighted_PCA_smoother
+	//Every point moves onto the weighted PCA plane of all its neighbors in a fixed radius, neighbors in dense areas weigh less
+	const unsigned int k = scaleSpaceNeighbors;
+
+	std::vector<Point> positions(scaled.size());
+	for (std::size_t i = 0; i < scaled.size(); ++i)
+		positions[i] = std::get<0>(scaled[i]);
+
+	//Voxels about the size of the radius, which holds about k points
+	KnnGrid grid;
+	grid.pointsPerCell = std::max(8.0f, static_cast<float>(k));
+	grid.Build(positions, threadPool);
+
+	//Radius from the mean distance to the k-th neighbor, estimated once like the smoother so every iteration uses the same scale
+	std::vector<double> chunkRadius(ThreadPool::ChunkCount(scaled.size(), PARALLEL_GRAIN), 0);
+
+	threadPool.ParallelFor(scaled.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<std::uint32_t> closest;
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			grid.Query(positions[i], k + 1, closest);
+			chunkRadius[begin / PARALLEL_GRAIN] += std::sqrt(CGAL::squared_distance(positions[i], positions[closest.back()]));
+		}
+	});
+
+	double radius = 0;
+	for (double value : chunkRadius)
+		radius += value;
+	radius /= scaled.size();
+
+	std::vector<Point> moved(scaled.size());
+	std::vector<unsigned int> density(scaled.size());
+
+	for (int iteration = 0; iteration < scaleSpaceIterations && !cancelRequested; ++iteration)
+	{
+		SetStatus("Scale Space " + std::to_string(iteration + 1) + "/" + std::to_string(scaleSpaceIterations));
+
+		if (iteration > 0)
+			grid.Build(positions, threadPool);
+
+		//Number of points within the radius, the point itself included
+		threadPool.ParallelFor(scaled.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			std::vector<std::uint32_t> list;
+
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				grid.QueryRadius(positions[i], static_cast<float>(radius), list);
+				density[i] = static_cast<unsigned int>(list.size());
+			}
+		});
+
+		StageFor(target, scaled.size(), [&](std::size_t begin, std::size_t end)
+		{
+			std::vector<std::uint32_t> list;
+
+			for (std::size_t i = begin; i < end; ++i)
+			{
+				const Point& query = positions[i];
+				moved[i] = query;
+
+				//If the neighborhood is too small, the point is not moved
+				if (density[i] < 4)
+					continue;
+
+				grid.QueryRadius(query, static_cast<float>(radius), list);
+
+				Vector barycenter(0, 0, 0);
+				FT weightSum = 0;
+
+				for (std::uint32_t n : list)
+				{
+					const FT weight = 1.0 / density[n];
+					barycenter = barycenter + weight * (positions[n] - CGAL::ORIGIN);
+					weightSum += weight;
+				}
+
+				barycenter = barycenter / weightSum;
+				const Point center = CGAL::ORIGIN + barycenter;
+
+				std::array<FT, 6> covariance = { { 0, 0, 0, 0, 0, 0 } };
+				for (std::uint32_t n : list)
+				{
+					const FT weight = 1.0 / density[n];
+					const Vector v = weight * (positions[n] - center);
+
+					covariance[0] += weight * v.x() * v.x();
+					covariance[1] += weight * v.x() * v.y();
+					covariance[2] += weight * v.x() * v.z();
+					covariance[3] += weight * v.y() * v.y();
+					covariance[4] += weight * v.y() * v.z();
+					covariance[5] += weight * v.z() * v.z();
+				}
+
+				std::array<FT, 3> eigenvalues = { { 0, 0, 0 } };
+				std::array<FT, 9> eigenvectors = { { 0, 0, 0, 0, 0, 0, 0, 0, 0 } };
+				CGAL::Default_diagonalize_traits<FT, 3>::diagonalize_selfadjoint_covariance_matrix(covariance, eigenvalues, eigenvectors);
+
+				//Projected onto the plane through the barycenter, orthogonal to the eigenvector with the smallest eigenvalue
+				const Vector normal(eigenvectors[0], eigenvectors[1], eigenvectors[2]);
+				const Vector offset = query - center;
+				moved[i] = center + offset - (normal * offset) * normal;
+			}
+		});
+
+		//Skipped chunks left points unmoved, the run throws the mesh away
+		if (cancelRequested)
+			return;
+
+		positions.swap(moved);
+	}
+
+	for (std::size_t i = 0; i < scaled.size(); ++i)
+		std::get<0>(scaled[i]) = positions[i];
+}
+
+bool MeshGenerator::GenerateInterpolatingMesh(StageTarget& target)
+{
+	auto start = std::chrono::steady_clock::now();
+	progress = 0;
+
+	std::vector<PointWithData> scaled;
+	if (meshMode == MeshMode::ScaleSpace)
+	{
+		//The points are meshed at a coarser scale, the mesh keeps their original positions
+		scaled = combinedModel.points;
+		ScaleSpaceSmooth(target, scaled);
+
+		if (cancelRequested)
+			return AbortRun();
+	}
+
+	const std::vector<PointWithData>& meshed = meshMode == MeshMode::ScaleSpace ? scaled : combinedModel.points;
+
+	std::vector<Point> positions(meshed.size());
+	for (std::size_t i = 0; i < meshed.size(); ++i)
+		positions[i] = std::get<0>(meshed[i]);
+
+	const double smoothSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	//Advancing front cannot be interrupted, cancelling is checked after it
+	SetStatus("Advancing Front");
+	progress = 0.5f;
+	start = std::chrono::steady_clock::now();
+
+	std::vector<std::array<std::size_t, 3>> facets;
+	CGAL::advancing_front_surface_reconstruction(positions.begin(), positions.end(), std::back_inserter(facets),
+		radiusRatioBound, frontBeta);
+
+	if (cancelRequested)
+		return AbortRun();
+
+	if (facets.empty())
+		return false;
+
+	//Only the points that ended up in a triangle become vertices
+	IndexedMesh mesh;
+	std::vector<std::uint32_t> remap(combinedModel.points.size(), std::numeric_limits<std::uint32_t>::max());
+
+	mesh.triangles.reserve(facets.size() * 3);
+	for (const auto& facet : facets)
+	{
+		for (std::size_t index : facet)
+		{
+			if (remap[index] == std::numeric_limits<std::uint32_t>::max())
+			{
+				remap[index] = static_cast<std::uint32_t>(mesh.VertexCount());
+
+				const Point& position = std::get<0>(combinedModel.points[index]);
+				mesh.vertices.insert(mesh.vertices.end(), {
+					static_cast<float>(position.x()), static_cast<float>(position.y()), static_cast<float>(position.z()) });
+			}
+
+			mesh.triangles.push_back(remap[index]);
+		}
+	}
+
+	const double meshSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::ostringstream result;
+	result << (meshMode == MeshMode::ScaleSpace ? "Scale Space" : "Advancing Front")
+		<< ": smooth " << smoothSeconds << " s, mesh " << meshSeconds << " s, "
+		<< mesh.TriangleCount() << " triangles\n";
+	meshResult = result.str();
+
+	return FinishMesh(mesh);
 }
 
-void MeshGenerator::HierarchySimplify()
+bool MeshGenerator::ExtractSurfaceNets(const std::function<FT(Point)>& function, bool threadSafe, IndexedMesh& mesh)
 {
-	combinedModel.points.erase(
-		CGAL::hierarchy_simplify_point_set(
-			combinedModel.points,
-			CGAL::parameters::size(maxClusterSize)
-			.maximum_variation(maxSurfaceVariation)
-			.point_map(PointMap())),
-		combinedModel.points.end());
+	SurfaceExtractor extractor;
+	if (!SampleSurfaceNets(function, threadSafe, extractor))
+		return false;
+
+	SetStatus("Extracting Surface");
+	return extractor.Extract(mesh, threadPool);
 }
 
-void MeshGenerator::GenerateNormals()
+bool MeshGenerator::SampleSurfaceNets(const std::function<FT(Point)>& function, bool threadSafe, SurfaceExtractor& extractor)
 {
-	//Generate normals
-	CGAL::pca_estimate_normals<CGAL::Sequential_tag>(
-		combinedModel.points,
-		24,
-		CGAL::parameters::point_map(PointMap())
-		.normal_map(NormalMap())
-		.neighbor_radius(2 * averageSpacing));
+	//The points' bounding box plus a few cells of margin, cut down to what the clip cube let through
+	//The cut box gets one more cell on every side, with the function bounded to the clip cube a surface reaching it then closes
+	//instead of ending open at the edge of the grid
+	const double cell = netCellSize * averageSpacing;
 
-	//Orient normals
-	//Delete normals that cannot be oriented
-	/*
-	 * Normals that cannot be oriented need to be deleted for better mesh generation
-	 */
-	combinedModel.points.erase(
-		CGAL::mst_orient_normals(
-			combinedModel.points,
-			24,
-			CGAL::parameters::point_map(PointMap())
-			.normal_map(NormalMap())),
-		combinedModel.points.end());
+	Point boxMin = std::get<0>(combinedModel.points.front());
+	Point boxMax = boxMin;
+
+	for (const auto& point : combinedModel.points)
+	{
+		const Point& position = std::get<0>(point);
+		boxMin = Point(std::min(boxMin.x(), position.x()), std::min(boxMin.y(), position.y()), std::min(boxMin.z(), position.z()));
+		boxMax = Point(std::max(boxMax.x(), position.x()), std::max(boxMax.y(), position.y()), std::max(boxMax.z(), position.z()));
+	}
+
+	const Vector margin(4 * cell, 4 * cell, 4 * cell);
+	boxMin = boxMin - margin;
+	boxMax = boxMax + margin;
 
+	if (combinedModel.clipped)
+	{
+		const Point& clipMin = combinedModel.clipMin;
+		const Point& clipMax = combinedModel.clipMax;
+
+		boxMin = Point(std::max(boxMin.x(), clipMin.x()), std::max(boxMin.y(), clipMin.y()), std::max(boxMin.z(), clipMin.z()));
+		boxMax = Point(std::min(boxMax.x(), clipMax.x()), std::min(boxMax.y(), clipMax.y()), std::min(boxMax.z(), clipMax.z()));
+
+		const Vector pad(cell, cell, cell);
+		boxMin = boxMin - pad;
+		boxMax = boxMax + pad;
+	}
+
+	SetStatus("Sampling Implicit Function");
+	return extractor.Sample([&function](const Point& p) { return function(p); }, threadSafe,
+		boxMin, boxMax, cell, threadPool,
+		[this](float done) { progress = 0.5f + done * 0.4f; });
 }
 
-void MeshGenerator::JetSmooth()
+void MeshGenerator::ReportMeshTimes(double solveSeconds, double meshSeconds, std::size_t triangles)
 {
-	CGAL::jet_smooth_point_set<CGAL::Sequential_tag>(
-		combinedModel.points,
-		jetNeighbors,
-		CGAL::parameters::point_map(PointMap()));
+	std::ostringstream result;
+	result << (meshSolver == MeshSolver::CGAL ? "CGAL Poisson" : "Screened Poisson")
+		<< ": solve " << solveSeconds << " s, mesh " << meshSeconds << " s, "
+		<< triangles << " triangles\n";
+	meshResult = result.str();
 }
 
-void MeshGenerator::SmoothPoints()
+bool MeshGenerator::FinishMesh(IndexedMesh& mesh, const std::string& name)
 {
-	for(int i = 0; i < smoothingIterations; ++i)
+	if (decimate && (decimateTarget > 0 || decimateError > 0))
 	{
-		CGAL::bilateral_smooth_point_set<CGAL::Sequential_tag>(
-			combinedModel.points,
-			neighborhoodSize,
-			CGAL::parameters::point_map(PointMap())
-			.normal_map(NormalMap())
-			.sharpness_angle(angleSharpness));
+		SetStatus("Decimating");
+		const auto start = std::chrono::steady_clock::now();
+		const std::size_t before = mesh.TriangleCount();
+
+		MeshDecimator decimator;
+		decimator.targetFaces = static_cast<std::size_t>(std::max(decimateTarget, 0));
+		decimator.maxError = decimateError * averageSpacing;
+
+		const float begin = progress;
+		if (!decimator.Decimate(mesh, threadPool, [this, begin](float done) { progress = begin + done * (1 - begin); }))
+			return cancelRequested ? AbortRun() : false;
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::ostringstream result;
+		result << "Decimate: " << before << " to " << mesh.TriangleCount() << " triangles in " << seconds << " s\n";
+		meshResult += result.str();
+	}
+
+	if (transferColors && !combinedModel.points.empty())
+	{
+		SetStatus("Transferring Colors");
+		const auto start = std::chrono::steady_clock::now();
+
+		ColorTransfer transfer;
+		transfer.neighbors = static_cast<unsigned int>(std::max(colorNeighbors, 1));
+		transfer.radius = static_cast<float>(colorRadius * averageSpacing);
+		transfer.normalPower = colorNormalPower;
+
+		if (!transfer.Transfer(combinedModel.points, mesh, threadPool) && cancelRequested)
+			return AbortRun();
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::ostringstream result;
+		result << "Colors: " << mesh.VertexCount() << " vertices in " << seconds << " s\n";
+		meshResult += result.str();
+	}
+
+	TextureImage texture;
+	if (bakeTexture)
+	{
+		if (!combinedModel.shotGrids || !combinedModel.frames)
+		{
+			meshResult += "Texture: no color frames kept for this model, skipped\n";
+		}
+		else
+		{
+			SetStatus("Baking Texture");
+			const auto start = std::chrono::steady_clock::now();
+
+			TextureBaker baker;
+			baker.textureSize = textureSize;
+			baker.visibilityTolerance = textureVisibility;
+
+			const float begin = progress;
+			const bool baked = baker.Bake(mesh, *combinedModel.shotGrids, *combinedModel.frames, threadPool, texture,
+				[this, begin](float done) { progress = begin + done * (1 - begin); });
+
+			if (!baked && cancelRequested)
+				return AbortRun();
+
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			//The atlas may have grown past the chosen size to fit the charts
+			std::ostringstream result;
+			if (baked)
+				result << "Texture: " << texture.width << " x " << texture.height << " in " << seconds << " s\n";
+			else
+				result << "Texture: the charts do not fit a " << baker.maxTextureSize << " x " << baker.maxTextureSize << " atlas, skipped\n";
+			meshResult += result.str();
+		}
+	}
+
+	progress = 1;
+	SetStatus("Generating OBJ");
+
+	if (!mesh.texcoords.empty())
+		Exporter::ExportTextured(mesh, texture, name);
+	else
+		Exporter::Export<Exporter::OBJ>(mesh, name);
+
+	if (!mesh.colors.empty())
+	{
+		SetStatus("Generating PLY");
+		Exporter::Export<Exporter::PLY>(mesh, name);
 	}
+
+	return true;
 }
 
-bool MeshGenerator::GenerateMesh()
+bool MeshGenerator::BenchmarkNeighbors(PointModel combModel)
 {
-	//Need to generate normals
-	SetStatus("Generating Normals");
-	GenerateNormals();
-	
-	//Gets the average spacing
-	SetStatus("Calculating average distance");
-	averageSpacing = CGAL::compute_average_spacing<CGAL::Sequential_tag>(
-		combinedModel.points, numberOfNeighbors, CGAL::parameters::point_map(PointMap()));
+	if (combModel.points.empty())
+		return false;
 
-	SetStatus("Generating Mesh");
-	
-	CGAL::Poisson_reconstruction_function<Kernel> possionFunction(
-		combinedModel.points.begin(), combinedModel.points.end(),
-		PointMap(), NormalMap());
+	BeginRun();
 
-	if (!possionFunction.compute_implicit_function())
-		return false;
+	std::ostringstream result;
+	result << combModel.points.size() << " points, " << threadPool.GetThreadCount() << " threads\n";
 
-	// and computes implicit function bounding sphere radius.
-	Point inner_point = possionFunction.get_inner_point();
-	Sphere bsphere = possionFunction.bounding_sphere();
-	FT radius = std::sqrt(bsphere.squared_radius());
-	// Defines the implicit surface: requires defining a
-	// conservative bounding sphere centered at inner point.
-	FT sm_sphere_radius = 5.0 * radius;
-	FT sm_dichotomy_error = distance * averageSpacing / 1000.0; // Dichotomy error must be << sm_distance
-	Surface_3 surface(possionFunction,
-		Sphere(inner_point, sm_sphere_radius * sm_sphere_radius),
-		sm_dichotomy_error / sm_sphere_radius);
-	// Defines surface mesh generation criteria
-	CGAL::Surface_mesh_default_criteria_3<STr> criteria(angle,  // Min triangle angle (degrees)
-		this->radius * averageSpacing,  // Max triangle size
-		distance * averageSpacing); // Approximation error
-// Generates surface mesh with manifold option
-	STr tr; // 3D Delaunay triangulation for surface mesh generation
-	C2t3 c2t3(tr); // 2D complex in 3D Delaunay triangulation
-	CGAL::make_surface_mesh(c2t3,                                 // reconstructed mesh
-		surface,                              // implicit surface
-		criteria,                             // meshing criteria
-		CGAL::Manifold_with_boundary_tag());  // require manifold mesh
-	
-	if (tr.number_of_vertices() == 0)
-		return false;
+	//The neighborhood sizes the stages use
+	const unsigned int sizes[3] = { 10, 24, 120 };
 
-	SetStatus("Generating OBJ");
+	for (int size = 0; size < 3; ++size)
+	{
+		const unsigned int k = sizes[size];
+
+		SetStatus("Benchmarking k = " + std::to_string(k));
+		progress = size / 3.0f;
+
+		NeighborCache tree;
+		tree.useGrid = false;
+
+		NeighborCache grid;
+		grid.useGrid = true;
+
+		auto start = std::chrono::steady_clock::now();
+		tree.Prepare(combModel.points, 0, k, threadPool);
+		const double treeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		grid.Prepare(combModel.points, 0, k, threadPool);
+		const double gridSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (cancelRequested)
+		{
+			SetStatus("Cancelled");
+			return false;
+		}
+
+		//Same neighbor sets, order can differ between points at equal distance
+		std::size_t matching = 0;
+		std::vector<std::uint32_t> a(k + 1);
+		std::vector<std::uint32_t> b(k + 1);
+
+		for (std::size_t i = 0; i < combModel.points.size(); ++i)
+		{
+			a.assign(tree.Neighbors(i), tree.Neighbors(i) + k + 1);
+			b.assign(grid.Neighbors(i), grid.Neighbors(i) + k + 1);
+			std::sort(a.begin(), a.end());
+			std::sort(b.begin(), b.end());
+			matching += a == b;
+		}
+
+		result << "k = " << k << ": kd-tree " << treeSeconds << "s, grid " << gridSeconds << "s, "
+			<< 100.0 * matching / combModel.points.size() << "% identical\n";
+	}
+
+	benchmarkResult = result.str();
 
-	CGAL::Polyhedron_3<Kernel> outMesh;
-	CGAL::facets_in_complex_2_to_triangle_mesh(c2t3, outMesh);
-	
-	Exporter::Export<Exporter::OBJ>(outMesh);
-	
 	return true;
 }
 
+void MeshGenerator::PublishSnapshot()
+{
+	if (pointsPublished)
+		return;
+
+	//Only the small rest of the model is copied, the points move
+	std::vector<PointWithData> points = std::move(combinedModel.points);
+	combinedModel.points.clear();
+
+	auto model = std::make_shared<PointModel>(combinedModel);
+	model->points = std::move(points);
+
+	std::atomic_store(&snapshot, std::shared_ptr<const PointModel>(std::move(model)));
+	pointsPublished = true;
+}
+
+void MeshGenerator::ReclaimPoints()
+{
+	if (!pointsPublished)
+		return;
+
+	const std::shared_ptr<const PointModel> model = std::atomic_load(&snapshot);
+	combinedModel.points = model ? model->points : std::vector<PointWithData>();
+	pointsPublished = false;
+}
+
 void MeshGenerator::Clear()
 {
-	hasModel = false;
+	std::atomic_store(&snapshot, std::shared_ptr<const PointModel>());
 	combinedModel.points.clear();
+	pointsPublished = false;
+	neighborCache.Clear();
+	stageCache.Clear();
+	++modelVersion;
 }
 
 void MeshGenerator::SetStatus(std::string newStatus)
@@ -198,56 +1657,241 @@ bool MeshGenerator::Init()
 
 bool MeshGenerator::Run(PointModel combModel)
 {
-	hasModel = false;
+	BeginRun();
 	
 	combinedModel = std::move(combModel);
+	pointsPublished = false;
+	++modelVersion;
 
-	hasModel = true;
+	if (tiled)
+	{
+		//Partitioning moves the input to disk and frees it, so it is never published and copied back
+		//The last snapshot is another cloud's, a cancelled tiled run leaves no model
+		std::atomic_store(&snapshot, std::shared_ptr<const PointModel>());
 
-	//Gets the average spacing
-	SetStatus("Calculating average distance");
-	averageSpacing = CGAL::compute_average_spacing<CGAL::Sequential_tag>(
-		combinedModel.points, numberOfNeighbors, CGAL::parameters::point_map(PointMap()));
+		const bool processed = RunTiled();
 
-	if (outliers)
-	{
-		SetStatus("Removing Outliers");
-		RemoveOutliers();
+		if (cancelRequested)
+			return AbortRun();
+
+		if (!processed)
+		{
+			//A failed partition still holds the input, later failures have already consumed it
+			if (!combinedModel.points.empty())
+				PublishSnapshot();
+			return false;
+		}
+
+		PublishSnapshot();
+
+		SetStatus("Export");
+		Exporter::Export<Exporter::PLY>(std::atomic_load(&snapshot).get(), pointCloudName, plyBinary, plyDouble);
+
+		return true;
 	}
-	
-	if (grid)
+
+	PublishSnapshot();
+
+	stageCache.SetBudget(static_cast<std::size_t>(cacheBudgetMB) * 1024 * 1024);
+
+	//Every stage key covers the input cloud and all the settings up to that stage
+	SetStatus("Hashing input");
+	std::uint64_t key = StageCache::HashValue(StageCache::HashPoints(std::atomic_load(&snapshot)->points, threadPool), numberOfNeighbors);
+
+	const std::vector<Stage> stages = GetStages();
+	std::vector<std::uint64_t> keys(stages.size());
+
+	for (std::size_t i = 0; i < stages.size(); ++i)
 	{
-		SetStatus("Grid Simplify");
-		GridSimplify();
+		if (stages[i].enabled)
+			key = StageCache::HashValue(StageCache::HashValue(key, i), stages[i].settingsHash);
+
+		keys[i] = key;
 	}
 
-	if (simplify)
+	//Resume after the last stage that has already been run with these settings
+	std::size_t firstStage = 0;
+	StageTarget target = CombinedTarget();
+
+	for (std::size_t i = stages.size(); i-- > 0;)
 	{
-		SetStatus("Hierarchy Simplify");
-		HierarchySimplify();
+		if (stages[i].enabled && stageCache.Find(keys[i], combinedModel, averageSpacing))
+		{
+			firstStage = i + 1;
+			pointsPublished = false;
+			PointsChanged(target);
+			PublishSnapshot();
+			break;
+		}
 	}
 
-	if (jetSmooth)
+	if (firstStage == 0)
 	{
-		SetStatus("Jet Smoothing");
-		JetSmooth();
+		//Gets the average spacing
+		SetStatus("Calculating average distance");
+		ReclaimPoints();
+		ComputeAverageSpacing(target);
 	}
-	
-	if (smoothing)
+
+	for (std::size_t i = firstStage; i < stages.size(); ++i)
 	{
-		SetStatus("Smoothing");
-		SmoothPoints();
+		if (!stages[i].enabled)
+			continue;
+
+		if (cancelRequested)
+			return AbortRun();
+
+		//The stage works on its own copy while the UI keeps drawing the last published points
+		SetStatus(stages[i].status);
+		progress = 0;
+		ReclaimPoints();
+		(this->*stages[i].run)(target);
+
+		//A cancelled stage's output is incomplete, it must not be cached
+		if (cancelRequested)
+			return AbortRun();
+
+		//The cache shares the published points instead of keeping a copy of its own
+		PublishSnapshot();
+		const std::shared_ptr<const PointModel> published = std::atomic_load(&snapshot);
+		stageCache.Store(keys[i], std::shared_ptr<const std::vector<PointWithData>>(published, &published->points), averageSpacing);
 	}
 	
 	SetStatus("Export");
-	Exporter::Export<Exporter::PLY>(&combinedModel);
+	Exporter::Export<Exporter::PLY>(std::atomic_load(&snapshot).get(), pointCloudName, plyBinary, plyDouble);
 
 	return true;
 }
 
-PointModel MeshGenerator::GetFinishedModel() const
+FT MeshGenerator::SampleAverageSpacing(const std::vector<PointWithData>& points)
+{
+	if (points.empty())
+		return 0;
+
+	std::vector<Point> positions(points.size());
+	threadPool.ParallelFor(positions.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+			positions[i] = std::get<0>(points[i]);
+	});
+
+	KnnGrid grid;
+	grid.Build(positions, threadPool);
+
+	//Same measure as NeighborCache::AverageSpacing, the point itself included
+	const std::size_t stride = std::max<std::size_t>(1, points.size() / SPACING_SAMPLES);
+	const std::size_t samples = (points.size() + stride - 1) / stride;
+	std::vector<FT> chunkSum(ThreadPool::ChunkCount(samples, PARALLEL_GRAIN), 0);
+
+	threadPool.ParallelFor(samples, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		std::vector<std::uint32_t> closest;
+		FT sum = 0;
+
+		for (std::size_t s = begin; s < end; ++s)
+		{
+			const Point& position = positions[s * stride];
+			grid.Query(position, numberOfNeighbors + 1, closest);
+
+			FT distances = 0;
+			for (std::uint32_t n : closest)
+				distances += std::sqrt(CGAL::squared_distance(position, positions[n]));
+
+			sum += closest.empty() ? 0 : distances / closest.size();
+		}
+
+		chunkSum[begin / PARALLEL_GRAIN] = sum;
+	});
+
+	FT sum = 0;
+	for (FT chunk : chunkSum)
+		sum += chunk;
+
+	return sum / samples;
+}
+
+void MeshGenerator::ProcessTile(PointModel& tile, float spacing)
+{
+	//Every tile gets its own neighborhoods, the spacing is the whole cloud's so thresholds match across tiles
+	NeighborCache tileNeighbors;
+	unsigned int tileVersion = 0;
+	float tileSpacing = spacing;
+	StageTarget target{ tile, tileNeighbors, tileVersion, tileSpacing, false };
+
+	for (const Stage& stage : GetStages())
+	{
+		if (stage.enabled)
+			(this->*stage.run)(target);
+	}
+}
+
+bool MeshGenerator::RunTiled()
+{
+	//Tiles are whole simplification cells and start on a cell border, so cells are not split between tiles
+	float size = tileSize;
+	float alignment = 0;
+	if (grid && gridCellSize > 0)
+	{
+		size = std::max(1.0f, std::round(tileSize / gridCellSize)) * gridCellSize;
+		alignment = gridCellSize;
+	}
+
+	TiledProcessor processor(size, tileHalo, static_cast<std::size_t>(tileBudgetMB) * 1024 * 1024, alignment);
+
+	//Thresholds derived from the spacing have to be the same in every tile
+	SetStatus("Calculating average distance");
+	averageSpacing = static_cast<float>(SampleAverageSpacing(combinedModel.points));
+
+	if (cancelRequested)
+		return false;
+
+	SetStatus("Writing tiles");
+	if (!processor.Partition(combinedModel))
+		return false;
+
+	++modelVersion;
+	neighborCache.Clear();
+
+	//Tiles only hold points, the shots they came from are shared with every tile
+	const std::vector<Point> viewpoints = combinedModel.viewpoints;
+	const std::shared_ptr<const std::vector<ShotGrid>> shotGrids = combinedModel.shotGrids;
+
+	const bool processed = processor.Process(combinedModel, threadPool,
+		[&](PointModel& tile)
+		{
+			tile.viewpoints = viewpoints;
+			tile.shotGrids = shotGrids;
+			ProcessTile(tile, averageSpacing);
+		},
+		[this](std::size_t finished, std::size_t total)
+		{
+			SetStatus("Processing tiles " + std::to_string(finished) + "/" + std::to_string(total));
+			progress = static_cast<float>(finished) / total;
+		});
+
+	++modelVersion;
+
+	return processed;
+}
+
+std::vector<MeshGenerator::Stage> MeshGenerator::GetStages() const
+{
+	return {
+		{ "View Consistency", viewConsistency, StageCache::HashValues(consistencyTolerance, consistencyViolations), &MeshGenerator::FilterViewConsistency },
+		{ "Thinning Overlap", overlapThinning, StageCache::HashValues(overlapCellSize), &MeshGenerator::ThinOverlap },
+		{ "Removing Outliers", outliers, StageCache::HashValues(numberOfNeighbors), &MeshGenerator::RemoveOutliers },
+		{ "Grid Simplify", grid, StageCache::HashValues(gridCellSize, static_cast<int>(gridMode)), &MeshGenerator::GridSimplify },
+		{ "WLOP Simplify", wlop, StageCache::HashValues(wlopTargetCount, wlopRadius, wlopIterations), &MeshGenerator::WlopSimplify },
+		//WLOP simplifies and regularizes in one pass, it replaces the three stages below
+		{ "Hierarchy Simplify", simplify && !wlop, StageCache::HashValues(maxClusterSize, maxSurfaceVariation), &MeshGenerator::HierarchySimplify },
+		{ "Jet Smoothing", jetSmooth && !wlop, StageCache::HashValues(jetNeighbors), &MeshGenerator::JetSmooth },
+		{ "Smoothing", smoothing && !wlop, StageCache::HashValues(neighborhoodSize, smoothingIterations, angleSharpness, smoothingStop, useShotNormals), &MeshGenerator::SmoothPoints }
+	};
+}
+
+std::shared_ptr<const PointModel> MeshGenerator::GetFinishedModel() const
 {
-	return combinedModel;
+	return std::atomic_load(&snapshot);
 }
 
 //Renders the mesh to texture for ui
@@ -269,7 +1913,10 @@ void MeshGenerator::RenderToTexture(float angle, float x, float y, float z)
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	if (!combinedModel.points.empty())
+	//Holds on to the snapshot while drawing, the generator may publish a new one meanwhile
+	const std::shared_ptr<const PointModel> model = std::atomic_load(&snapshot);
+
+	if (model && !model->points.empty())
 	{
 		glPointSize(1.0f);
 		glBegin(GL_POINTS);
@@ -277,7 +1924,7 @@ void MeshGenerator::RenderToTexture(float angle, float x, float y, float z)
 		Point point;
 		std::array<unsigned char, 3> color{};
 
-		for (auto& p : combinedModel.points)
+		for (auto& p : model->points)
 		{
 			point = std::get<0>(p);
 			color = std::get<1>(p);
@@ -301,8 +1948,55 @@ GLuint* MeshGenerator::GetTexture()
 }
 
 //Renders UI
+void MeshGenerator::SetPointCloudPath(const std::string& path)
+{
+	pointCloudName = std::filesystem::path(path).replace_extension().string();
+}
+
 void MeshGenerator::RenderSettings()
 {
+	ImGui::Separator();
+	ImGui::DragInt("Threads (0 = All Cores)", &threadCount, 1, 0, 256);
+	ImGui::DragInt("Stage Cache (MB)", &cacheBudgetMB, 16, 0, 65536);
+	ImGui::Text("Cached stages: %d (%d MB)", static_cast<int>(stageCache.GetEntryCount()), static_cast<int>(stageCache.GetUsedBytes() / (1024 * 1024)));
+
+	if (!benchmarkResult.empty())
+		ImGui::TextUnformatted(benchmarkResult.c_str());
+
+	ImGui::Checkbox("Tiled Processing", &tiled);
+
+	if (tiled)
+	{
+		ImGui::Text("Tiles are written to disk and processed within the memory budget");
+		ImGui::DragFloat("Tile Size", &tileSize, 0.01f, 0.01f, 10.0f);
+		ImGui::DragFloat("Tile Halo", &tileHalo, 0.001f, 0.0f, tileSize);
+		ImGui::DragInt("Tile Memory (MB)", &tileBudgetMB, 16, 64, 65536);
+	}
+
+	ImGui::Separator();
+	ImGui::Text("Point cloud: %s.ply", pointCloudName.c_str());
+	ImGui::Checkbox("Binary PLY", &plyBinary);
+	ImGui::Checkbox("Double Precision PLY", &plyDouble);
+
+	ImGui::Separator();
+	ImGui::Checkbox("View Consistency", &viewConsistency);
+
+	if (viewConsistency)
+	{
+		ImGui::Text("Removes points other shots see through");
+		ImGui::DragFloat("Depth Tolerance", &consistencyTolerance, 0.001f, 0.001f, 0.5f);
+		ImGui::DragInt("Violating Shots", &consistencyViolations, 1, 1, 64);
+	}
+
+	ImGui::Separator();
+	ImGui::Checkbox("Thin Overlap", &overlapThinning);
+
+	if (overlapThinning)
+	{
+		ImGui::Text("Keeps the best seeing shot per patch");
+		ImGui::DragFloat("Patch Size", &overlapCellSize, 0.0005f, 0.0005f, 0.1f, "%.4f");
+	}
+
 	ImGui::Separator();
 	ImGui::Checkbox("Remove Outliers", &outliers);
 
@@ -319,6 +2013,21 @@ void MeshGenerator::RenderSettings()
 	{
 		ImGui::Text("Grid Simplify");
 		ImGui::DragFloat("Grid Size", &gridCellSize, 0.001f, 0.001f, 1.0f);
+
+		const char* gridModes[] = { "First Point", "Average", "Nearest To Centroid" };
+		int mode = static_cast<int>(gridMode);
+		ImGui::Combo("Grid Mode", &mode, gridModes, IM_ARRAYSIZE(gridModes));
+		gridMode = static_cast<GridMode>(mode);
+	}
+
+	ImGui::Checkbox("WLOP Simplify", &wlop);
+
+	if (wlop)
+	{
+		ImGui::Text("WLOP replaces Hierarchy Simplify, Jet Smooth and Smooth");
+		ImGui::DragInt(tiled ? "Target Points (per tile)" : "Target Points", &wlopTargetCount, 1000, 1000, 10000000);
+		ImGui::DragFloat("Neighbor Radius (x spacing)", &wlopRadius, 0.1f, 1.0f, 50.0f);
+		ImGui::DragInt("WLOP Iterations", &wlopIterations, 1, 1, 100);
 	}
 
 	ImGui::Checkbox("Hierarchy Simplify", &simplify);
@@ -347,10 +2056,99 @@ void MeshGenerator::RenderSettings()
 		ImGui::DragInt("Neighborhood Size", &neighborhoodSize, 1, 1, 200);
 		ImGui::DragFloat("Angle Sharpness", &angleSharpness, 0.1, 1.0f, 100.f);
 		ImGui::DragInt("Iterations", &smoothingIterations, 1, 1, 100);
+		ImGui::DragFloat("Stop Displacement", &smoothingStop, 0.001f, 0.0f, 1.0f);
 	}
 
+	ImGui::Separator();
+	ImGui::Checkbox("Use Shot Normals", &useShotNormals);
+
+	const char* orientations[] = { "Toward Camera", "Minimum Spanning Tree" };
+	int orientation = static_cast<int>(normalOrientation);
+	ImGui::Combo("Normal Orientation", &orientation, orientations, IM_ARRAYSIZE(orientations));
+	normalOrientation = static_cast<NormalOrientation>(orientation);
+
 	ImGui::Separator();
 	ImGui::Text("Mesh Generation");
+
+	const char* meshModes[] = { "Poisson", "Advancing Front", "Scale Space" };
+	int mode = static_cast<int>(meshMode);
+	ImGui::Combo("Reconstruction", &mode, meshModes, IM_ARRAYSIZE(meshModes));
+	meshMode = static_cast<MeshMode>(mode);
+
+	ImGui::Checkbox("Decimate", &decimate);
+	if (decimate)
+	{
+		ImGui::DragInt("Target Faces", &decimateTarget, 1000, 0, 10000000);
+		ImGui::DragFloat("Max Error", &decimateError, 0.01f, 0.0f, 10.0f);
+	}
+
+	ImGui::Checkbox("Transfer Colors", &transferColors);
+	if (transferColors)
+	{
+		ImGui::DragInt("Color Neighbors", &colorNeighbors, 1, 1, 64);
+		ImGui::DragFloat("Color Radius", &colorRadius, 0.1f, 0.1f, 20.0f);
+		ImGui::DragFloat("Normal Agreement", &colorNormalPower, 0.1f, 0.0f, 16.0f);
+	}
+
+	ImGui::Checkbox("Bake Texture", &bakeTexture);
+	if (bakeTexture)
+	{
+		const char* sizes[] = { "1024", "2048", "4096", "8192" };
+		int size = 0;
+		while (size < 3 && (1024 << size) < textureSize)
+			++size;
+		ImGui::Combo("Texture Size", &size, sizes, IM_ARRAYSIZE(sizes));
+		textureSize = 1024 << size;
+
+		ImGui::DragFloat("Visibility Tolerance", &textureVisibility, 0.001f, 0.001f, 0.1f, "%.3f");
+	}
+
+	if (meshMode != MeshMode::Poisson)
+	{
+		ImGui::Text("Interpolates the points, no normals needed");
+		ImGui::DragFloat("Radius Ratio Bound", &radiusRatioBound, 0.1f, 1.0f, 100.0f);
+		ImGui::DragFloat("Beta", &frontBeta, 0.01f, 0.0f, 1.57f);
+
+		if (meshMode == MeshMode::ScaleSpace)
+		{
+			ImGui::DragInt("Scale Neighbors", &scaleSpaceNeighbors, 1, 4, 100);
+			ImGui::DragInt("Scale Iterations", &scaleSpaceIterations, 1, 1, 20);
+		}
+
+		if (!meshResult.empty())
+			ImGui::TextUnformatted(meshResult.c_str());
+
+		return;
+	}
+
+	const char* solvers[] = { "CGAL Poisson", "Screened Poisson" };
+	int solver = static_cast<int>(meshSolver);
+	ImGui::Combo("Solver", &solver, solvers, IM_ARRAYSIZE(solvers));
+	meshSolver = static_cast<MeshSolver>(solver);
+
+	if (meshSolver == MeshSolver::Screened)
+	{
+		ImGui::DragInt("Solver Depth", &solverDepth, 1, 5, POISSON_MAX_DEPTH);
+		ImGui::DragFloat("Screening", &solverScreening, 0.1f, 0.0f, 64.0f);
+		ImGui::DragInt("Max Iterations Per Level", &solverIterations, 1, 1, 500);
+	}
+
+	const char* extractions[] = { "Delaunay Refinement", "Surface Nets" };
+	int extraction = static_cast<int>(meshExtraction);
+	ImGui::Combo("Extraction", &extraction, extractions, IM_ARRAYSIZE(extractions));
+	meshExtraction = static_cast<MeshExtraction>(extraction);
+
+	if (meshExtraction == MeshExtraction::SurfaceNets)
+		ImGui::DragFloat("Net Cell Size", &netCellSize, 0.1f, 0.5f, 20.0f);
+
+	ImGui::DragInt("LOD Levels", &meshLevels, 1, 1, 6);
+
+	ImGui::Checkbox("Bound To Clip Box", &boundDomain);
+	if (boundDomain)
+		ImGui::DragFloat("Domain Margin", &domainMargin, 0.5f, 0.0f, 100.0f);
+
+	if (!meshResult.empty())
+		ImGui::TextUnformatted(meshResult.c_str());
 	
 	float value = angle;
 	ImGui::DragFloat("Max Angle", &value, 0.1f, 10.0f, 90.0f);
@@ -1,8 +1,15 @@
 #pragma once
 
 #include "ModelData.h"
+#include "NeighborCache.h"
+#include "StageCache.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
 
+class SurfaceExtractor;
 
 class MeshGenerator
 {
@@ -14,6 +21,15 @@ class MeshGenerator
 	//TODO:Outlier removal
     //TODO:Get point cloud normals
 
+    //Multi-view consistency, drops points other shots see in front of their surface
+    bool viewConsistency = true;
+    float consistencyTolerance = 0.01f; //Meters in front of the measured depth before a shot disagrees
+    int consistencyViolations = 2; //Disagreeing shots needed to remove a point
+
+    //Overlap thinning, every patch keeps the points of the shot that saw it best
+    bool overlapThinning = true;
+    float overlapCellSize = 0.002f;
+
     //Outlier removal settings
     bool outliers = true;
     int numberOfNeighbors = 24;
@@ -22,12 +38,38 @@ class MeshGenerator
     //Grid Simplification
     bool grid = true;
     float gridCellSize = 0.001f;
+
+    //What a grid cell is reduced to
+    enum class GridMode
+    {
+        First, //The cell's first point, as CGAL::grid_simplify_point_set
+        Average, //Mean position, color and normal of the cell
+        Centroid //The cell's point closest to the mean position
+    };
+    GridMode gridMode = GridMode::Average;
 	
     //Simplification
     bool simplify = true;
 	int maxClusterSize = 10;
 	float maxSurfaceVariation = 0.001;
 
+    //Normals computed per shot from the depth grid, PCA only fills in the ones missing
+    bool useShotNormals = true;
+
+    //How GenerateNormals orients the normals
+    enum class NormalOrientation
+    {
+        Viewpoint, //Flip toward the camera of the point's shot
+        MinimumSpanningTree //CGAL::mst_orient_normals, deletes points it cannot orient
+    };
+    NormalOrientation normalOrientation = NormalOrientation::Viewpoint;
+
+    //WLOP simplify and regularize
+    bool wlop = false;
+    int wlopTargetCount = 50000;
+    float wlopRadius = 8; //w.r.t. average spacing, CGAL's default
+    int wlopIterations = 35;
+
     //Jet Smoothing
     bool jetSmooth = true;
     int jetNeighbors = 10;
@@ -37,31 +79,225 @@ class MeshGenerator
     int neighborhoodSize = 120; // Bigger = Smoother
     int smoothingIterations = 2;
     float angleSharpness = 25; //Needs to be bigger than 1	
+    float smoothingStop = 0.01f; //Stops iterating once points move less than this (w.r.t. average spacing)
 	
     PointModel combinedModel;
 
-    bool hasModel = false;
+    //Threads used by the stages, 0 = one per core
+    int threadCount = 0;
+    ThreadPool threadPool;
+
+    //Neighborhoods shared by every stage
+    NeighborCache neighborCache;
+
+    //Bumped every time points are added to or removed from combinedModel
+    unsigned int modelVersion = 0;
+
+    //Out of core processing, the cloud is split into tiles on disk with halo margins
+    bool tiled = false;
+    float tileSize = 0.1f;
+    float tileHalo = 0.02f;
+    int tileBudgetMB = 1024;
+
+    //Processed point cloud, written as name + .ply after every run
+    std::string pointCloudName = "point";
+    bool plyBinary = true;
+    bool plyDouble = false; //Double instead of float coordinates and normals
+
+    //Outputs of earlier runs, so changing a setting only reruns the stages after it
+    StageCache stageCache;
+    int cacheBudgetMB = 2048;
+
+    //Points a stage works on, the whole combined model or a single tile of it
+    struct StageTarget
+    {
+        PointModel& model;
+        NeighborCache& neighbors;
+        unsigned int& version;
+        float& averageSpacing;
+
+        //Only the combined model reports progress, tiles run side by side
+        bool reportProgress;
+    };
+
+    //A point processing stage of Run
+    struct Stage
+    {
+        const char* status;
+        bool enabled;
+        std::uint64_t settingsHash;
+        void (MeshGenerator::*run)(StageTarget&);
+    };
+
+    //Stages in the order Run applies them
+    std::vector<Stage> GetStages() const;
+
+    //Last published state of combinedModel, never modified after publishing
+    //Swapped atomically so the UI can draw it while Run works on combinedModel
+    std::shared_ptr<const PointModel> snapshot;
+
+    //combinedModel's points were moved into the snapshot, combinedModel only holds the rest of the model
+    bool pointsPublished = false;
+
+    //Moves combinedModel's points into a new snapshot without copying them
+    void PublishSnapshot();
+
+    //Gives combinedModel a writable copy of the published points, the snapshot stays as it is for the UI
+    void ReclaimPoints();
 	
 	//Triangulation settings
+    enum class MeshMode
+    {
+        Poisson, //Oriented normals, an implicit function and its zero level
+        AdvancingFront, //CGAL::advancing_front_surface_reconstruction on the points
+        ScaleSpace //Advancing front on scale space smoothed points, keeping the original positions
+    };
+    MeshMode meshMode = MeshMode::Poisson;
+
+    //Advancing front, CGAL's defaults
+    float radiusRatioBound = 5;
+    float frontBeta = 0.52f;
+
+    //Scale space, CGAL's default neighborhood
+    int scaleSpaceNeighbors = 12;
+    int scaleSpaceIterations = 4;
+
+    //Implicit function the surface is meshed from
+    enum class MeshSolver
+    {
+        CGAL, //CGAL::Poisson_reconstruction_function, refined Delaunay and a single threaded solve
+        Screened //PoissonSolver, screened Poisson on nested grids solved coarse to fine on the thread pool, the fine ones only around the points
+    };
+    MeshSolver meshSolver = MeshSolver::CGAL;
+    int solverDepth = 8; //2^depth cells per axis
+    float solverScreening = 4;
+    int solverIterations = 100; //Most per level, a level stops once its residual is small
+
+    //How the mesh is taken from the implicit function
+    enum class MeshExtraction
+    {
+        DelaunayRefinement, //CGAL::make_surface_mesh, sequential
+        SurfaceNets //SurfaceExtractor on a grid over the clip cube, in parallel
+    };
+    MeshExtraction meshExtraction = MeshExtraction::DelaunayRefinement;
+    float netCellSize = 2; //Grid cell w.r.t. average spacing
+
+    //Levels of detail meshed from one solve, each coarser level doubles the cell or triangle size, 1 = a single mesh
+    int meshLevels = 1;
+
+    //Solves and meshes only inside the scan's clip box plus this margin w.r.t. average spacing, skips the empty space around it
+    bool boundDomain = true;
+    float domainMargin = 10;
+
+    //Quadric edge collapse of the finished mesh, by face count and/or error
+    bool decimate = false;
+    int decimateTarget = 100000; //Faces to keep, 0 = only the error bound
+    float decimateError = 0; //Max collapse error w.r.t. average spacing, 0 = no bound
+
+    //Vertex colors blended from the nearest cloud points, exported as a colored PLY next to the OBJ
+    bool transferColors = true;
+    int colorNeighbors = 8;
+    float colorRadius = 1; //Distance falloff w.r.t. average spacing
+    float colorNormalPower = 2; //Sharpness of the normal agreement weight
+
+    //Texture atlas baked from the shots' color frames, exported as OBJ, MTL and PNG
+    bool bakeTexture = false;
+    int textureSize = 2048;
+    float textureVisibility = 0.01f; //Meters a texel may lie behind a shot's depth and still be seen
+
+    //Timings of the last mesh, shown in the settings to compare the solvers
+    std::string meshResult = "";
+
+    //Moves a copy of the points to a coarser scale with weighted PCA projections
+    void ScaleSpaceSmooth(StageTarget& target, std::vector<PointWithData>& scaled);
+
+    //Advancing front or scale space mesh of the combined model
+    bool GenerateInterpolatingMesh(StageTarget& target);
+
+    //Samples the implicit function over the points' box inside the clip cube and meshes it with surface nets
+    bool ExtractSurfaceNets(const std::function<FT(Point)>& function, bool threadSafe, IndexedMesh& mesh);
+    bool SampleSurfaceNets(const std::function<FT(Point)>& function, bool threadSafe, SurfaceExtractor& extractor);
+
+    //CGAL::make_surface_mesh of the function, scale multiplies the triangle size and approximation error
+    bool MeshDelaunay(const std::function<FT(Point)>& function, const Point& innerPoint, FT sphereRadius, FT scale, IndexedMesh& mesh);
+
+    //Meshes and exports every level of detail of one solved function, in parallel when the function is thread safe
+    bool GenerateLevels(const std::function<FT(Point)>& function, bool threadSafe, const Point& innerPoint, FT sphereRadius, double solveSeconds);
+
+    void ReportMeshTimes(double solveSeconds, double meshSeconds, std::size_t triangles);
+
+    //Decimates, colors and textures the mesh when enabled and exports it
+    bool FinishMesh(IndexedMesh& mesh, const std::string& name = "MeshOut");
+
     // Poisson options
     FT angle = 20.0; // Min triangle angle in degrees.
     FT radius = 50.0; // Max triangle size w.r.t. point set average spacing.
     FT distance = 0.5; // Surface Approximation error w.r.t. point set average spacing.
 
-    void RemoveOutliers();
+    //Removes points that other shots' depth images show as free space
+    void FilterViewConsistency(StageTarget& target);
 
-    void GridSimplify();
+    //Drops the points of shots that saw a patch worse than another shot
+    void ThinOverlap(StageTarget& target);
+
+    void RemoveOutliers(StageTarget& target);
+
+    void GridSimplify(StageTarget& target);
 	
-	void HierarchySimplify();
+	void HierarchySimplify(StageTarget& target);
+
+    void WlopSimplify(StageTarget& target);
 	
-    void GenerateNormals();
+    //Unoriented PCA normals from the shared lists, missingOnly keeps the normals points already have
+    void EstimateNormals(StageTarget& target, bool missingOnly);
+
+    void GenerateNormals(StageTarget& target);
 
-    void JetSmooth();
+    //Flips every normal toward the camera position of its shot
+    void OrientTowardViewpoints(StageTarget& target);
+
+    void JetSmooth(StageTarget& target);
 	
-    void SmoothPoints();
+    void SmoothPoints(StageTarget& target);
+
+    //Average spacing from the shared neighbor lists
+    void ComputeAverageSpacing(StageTarget& target);
+
+    //Points were added or removed, the neighbor lists are no longer valid
+    static void PointsChanged(StageTarget& target);
+
+    //Target for the whole combined model
+    StageTarget CombinedTarget();
+
+    //Average spacing of a strided sample of the points to their neighbors in the whole cloud
+    FT SampleAverageSpacing(const std::vector<PointWithData>& points);
+
+    //Runs every enabled stage on a single tile, with the whole cloud's average spacing
+    void ProcessTile(PointModel& tile, float spacing);
+
+    //Runs the stages tile by tile under the tile memory budget
+    bool RunTiled();
 
     std::string status = "";
 
+    //Set from the UI thread, checked by the thread pool chunks and between stages
+    std::atomic<bool> cancelRequested{ false };
+
+    //Fraction of the current stage that is done
+    std::atomic<float> progress{ 0 };
+
+    //ParallelFor over a stage's points that reports the fraction done as progress
+    void StageFor(const StageTarget& target, std::size_t count, const std::function<void(std::size_t, std::size_t)>& func);
+
+    //Starts a new run, clears any earlier cancel
+    void BeginRun();
+
+    //Throws away the half processed cloud and goes back to the last snapshot
+    bool AbortRun();
+
+    //Last neighbor benchmark, shown in the settings
+    std::string benchmarkResult = "";
+
     std::mutex statusMutex;
 
     void SetStatus(std::string newStatus);
@@ -70,13 +306,13 @@ public:
 
     bool Init();
 
-    bool ModelAvailable() const { return hasModel; }
+    bool ModelAvailable() const { return std::atomic_load(&snapshot) != nullptr; }
 	
 	//Runs the mesh generation on the point model
     bool Run(PointModel combModel);
 
-	//Returns model after finished
-    PointModel GetFinishedModel() const;
+	//Returns the latest published model, the finished one once Run returns
+    std::shared_ptr<const PointModel> GetFinishedModel() const;
 
 	//Render the model to the texture
     void RenderToTexture(float angle, float x, float y, float z);
@@ -85,9 +321,21 @@ public:
 
     void RenderSettings();
 
+    //Where the point cloud is exported, the extension is replaced with .ply
+    void SetPointCloudPath(const std::string& path);
+
     std::string GetStatus();
 
+    //Fraction of the current stage that is done, 0 to 1
+    float GetProgress() const { return progress; }
+
+    //Asks the running stage to stop, Run and GenerateMesh then return false
+    void Cancel() { cancelRequested = true; }
+
     bool GenerateMesh();
 
+    //Times the grid kNN search against the CGAL kd-tree on the point model and checks they agree
+    bool BenchmarkNeighbors(PointModel combModel);
+
     void Clear();
 };
\ No newline at end of file
@@ -1,9 +1,9 @@
 #include "ModelCapture.h"
+#include <algorithm>
 #include <cmath>
 #include "imgui.h"
 #include "glm/glm.hpp"
 
-#include <CGAL/wlop_simplify_and_regularize_point_set.h>
 #include <CGAL/IO/write_ply_points.h>
 
 #include <opencv2/imgproc.hpp>
@@ -12,14 +12,162 @@
 
 #define BACK_SUB_AMOUNT 100
 
-void ModelCapture::GetCameraFrame()
+//Depth difference (meters) above which grid neighbors are on another surface
+#define NORMAL_DEPTH_JUMP 0.02f
+
+bool ModelCapture::GetShotNormal(const CameraSpacePoint* xyz, int index, Vector& normal) const
+{
+	const int x = index % DEPTH_SENSOR_WIDTH;
+	const int y = index / DEPTH_SENSOR_WIDTH;
+	const int step = std::max(1, scan_settings_.normalStep);
+	const CameraSpacePoint& center = xyz[index];
+
+	//Neighbor on the same surface, or the center pixel itself
+	auto neighbor = [&](int px, int py) -> const CameraSpacePoint&
+	{
+		if (px < 0 || py < 0 || px >= DEPTH_SENSOR_WIDTH || py >= DEPTH_SENSOR_HEIGHT)
+			return center;
+
+		const CameraSpacePoint& point = xyz[px + py * DEPTH_SENSOR_WIDTH];
+
+		if (!std::isfinite(point.Z) || std::abs(point.Z - center.Z) > NORMAL_DEPTH_JUMP)
+			return center;
+
+		return point;
+	};
+
+	//Central differences, one sided next to holes and edges
+	const CameraSpacePoint& left = neighbor(x - step, y);
+	const CameraSpacePoint& right = neighbor(x + step, y);
+	const CameraSpacePoint& up = neighbor(x, y - step);
+	const CameraSpacePoint& down = neighbor(x, y + step);
+
+	const glm::vec3 horizontal(right.X - left.X, right.Y - left.Y, right.Z - left.Z);
+	const glm::vec3 vertical(down.X - up.X, down.Y - up.Y, down.Z - up.Z);
+
+	glm::vec3 cross = glm::cross(horizontal, vertical);
+	const float length = glm::length(cross);
+
+	if (!(length > 0.0f))
+		return false;
+
+	cross /= length;
+
+	//Camera sits at the origin of its space
+	if (glm::dot(cross, glm::vec3(center.X, center.Y, center.Z)) > 0.0f)
+		cross = -cross;
+
+	normal = Vector(cross.x, cross.y, cross.z);
+	return true;
+}
+
+void ModelCapture::FillShotGrid(const CameraSpacePoint* xyz, const ColorSpacePoint* rgb, ShotGrid& grid)
+{
+	grid.width = DEPTH_SENSOR_WIDTH;
+	grid.height = DEPTH_SENSOR_HEIGHT;
+	grid.depth.resize(DEPTH_SENSOR_WIDTH * DEPTH_SENSOR_HEIGHT);
+
+	//Pooled grids still hold the last shot's frame and fit
+	grid.frame = -1;
+	std::fill(std::begin(grid.colorProjection), std::end(grid.colorProjection), 0.0f);
+
+	//Least squares line per axis, pixel = scale * X / Z + offset
+	double sum[2][4] = {};
+
+	//Normal equations of the color fit per axis, basis (X / Z, 1 / Z, 1) against the mapped color pixel
+	double colorMatrix[2][3][3] = {};
+	double colorTarget[2][3] = {};
+	
+	for (int i = 0; i < (DEPTH_SENSOR_WIDTH * DEPTH_SENSOR_HEIGHT); ++i)
+	{
+		const CameraSpacePoint& point = xyz[i];
+
+		if (!std::isfinite(point.Z) || point.Z <= 0)
+		{
+			grid.depth[i] = 0;
+			continue;
+		}
+
+		grid.depth[i] = static_cast<std::uint16_t>(std::min(point.Z * 1000.0f + 0.5f, 65535.0f));
+
+		const double pixel[2] = { static_cast<double>(i % DEPTH_SENSOR_WIDTH), static_cast<double>(i / DEPTH_SENSOR_WIDTH) };
+		const double ray[2] = { point.X / point.Z, point.Y / point.Z };
+
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			sum[axis][0] += ray[axis];
+			sum[axis][1] += pixel[axis];
+			sum[axis][2] += ray[axis] * ray[axis];
+			sum[axis][3] += ray[axis] * pixel[axis];
+		}
+
+		const ColorSpacePoint& color = rgb[i];
+		if (!std::isfinite(color.X) || !std::isfinite(color.Y) ||
+			color.X < 0 || color.Y < 0 || color.X >= RGB_SENSOR_WIDTH || color.Y >= RGB_SENSOR_HEIGHT)
+			continue;
+
+		const double colorPixel[2] = { color.X, color.Y };
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			const double basis[3] = { ray[axis], 1.0 / point.Z, 1.0 };
+
+			for (int row = 0; row < 3; ++row)
+			{
+				for (int column = 0; column < 3; ++column)
+					colorMatrix[axis][row][column] += basis[row] * basis[column];
+				colorTarget[axis][row] += basis[row] * colorPixel[axis];
+			}
+		}
+	}
+
+	//Cramer's rule, the fit stays zero when the shot mapped too few pixels
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		const double (&m)[3][3] = colorMatrix[axis];
+		const double* b = colorTarget[axis];
+
+		auto determinant = [](double a0, double a1, double a2, double b0, double b1, double b2, double c0, double c1, double c2)
+		{
+			return a0 * (b1 * c2 - b2 * c1) - a1 * (b0 * c2 - b2 * c0) + a2 * (b0 * c1 - b1 * c0);
+		};
+
+		const double full = determinant(m[0][0], m[0][1], m[0][2], m[1][0], m[1][1], m[1][2], m[2][0], m[2][1], m[2][2]);
+		if (std::abs(full) < 1e-12)
+			continue;
+
+		grid.colorProjection[axis * 3] = static_cast<float>(determinant(b[0], m[0][1], m[0][2], b[1], m[1][1], m[1][2], b[2], m[2][1], m[2][2]) / full);
+		grid.colorProjection[axis * 3 + 1] = static_cast<float>(determinant(m[0][0], b[0], m[0][2], m[1][0], b[1], m[1][2], m[2][0], b[2], m[2][2]) / full);
+		grid.colorProjection[axis * 3 + 2] = static_cast<float>(determinant(m[0][0], m[0][1], b[0], m[1][0], m[1][1], b[1], m[2][0], m[2][1], b[2]) / full);
+	}
+
+	const double count = static_cast<double>(std::count_if(grid.depth.begin(), grid.depth.end(), [](std::uint16_t depth) { return depth > 0; }));
+
+	for (int axis = 0; axis < 2; ++axis)
+	{
+		const double denominator = count * sum[axis][2] - sum[axis][0] * sum[axis][0];
+
+		if (count < 2 || denominator == 0)
+		{
+			grid.projection[axis * 2] = 0;
+			grid.projection[axis * 2 + 1] = 0;
+			continue;
+		}
+
+		const double scale = (count * sum[axis][3] - sum[axis][0] * sum[axis][1]) / denominator;
+		grid.projection[axis * 2] = static_cast<float>(scale);
+		grid.projection[axis * 2 + 1] = static_cast<float>((sum[axis][1] - scale * sum[axis][0]) / count);
+	}
+}
+
+void ModelCapture::GetCameraFrame(bool keepFrame)
 {
 	const ModelShot* current_shot = camera_->GetCurrentModelShot();
 
 	if (!current_shot)
 		return;
 	
-	PointModel shot;
+	//Every depth pixel could end up in the shot, scanned shots are cut down to what they hold below
+	PointModel shot = shotPool.Acquire(DEPTH_SENSOR_WIDTH * DEPTH_SENSOR_HEIGHT);
 
 	if (hasIgnore)
 	{		
@@ -64,20 +212,55 @@ void ModelCapture::GetCameraFrame()
 					(cubeMin[1] <= current_shot->xyz[i].Y && cubeMax[1] >= current_shot->xyz[i].Y) &&
 					(cubeMin[2] <= current_shot->xyz[i].Z && cubeMax[2] >= current_shot->xyz[i].Z)))
 		{
+			//No normal leaves a null vector, the mesh generator estimates those
+			//The preview never uses normals, only scanned shots compute them
+			Vector normal(0, 0, 0);
+			if (keepFrame)
+				GetShotNormal(current_shot->xyz, i, normal);
+
 			shot.AddPoint(
 					current_shot->xyz[i].X,
 					current_shot->xyz[i].Y,
 					current_shot->xyz[i].Z,
 					current_shot->rgbimage[(4 * idx)],
 					current_shot->rgbimage[(4 * idx) + 1],
-					current_shot->rgbimage[(4 * idx) + 2]
+					current_shot->rgbimage[(4 * idx) + 2],
+					normal
 				);
 		}
 	}
 
 	//If we didn't get any points separate
 	if (shot.points.empty())
+	{
+		shotPool.Release(std::move(shot));
 		return;
+	}
+
+	//Only scanned shots are fitted and keep their color frame for texture baking, preview frames are thrown away
+	//A preview's pooled grid is emptied so nothing reads the last scan's fit from it
+	if (keepFrame)
+	{
+		FillShotGrid(current_shot->xyz, current_shot->rgb, shot.grid);
+
+		if (frameStore)
+			shot.grid.frame = frameStore->Append(current_shot->rgbimage);
+	}
+	else
+	{
+		shot.grid.depth.clear();
+		shot.grid.frame = -1;
+	}
+
+	//A scan keeps its shots until it is cleared, so they only hold the clipped points
+	//The full frame buffer goes back to the pool for the next shot
+	if (keepFrame)
+	{
+		PointModel buffer;
+		buffer.points = std::move(shot.points);
+		shot.points.assign(buffer.points.begin(), buffer.points.end());
+		shotPool.Release(std::move(buffer));
+	}
 	
 	currentModel.push_back(std::move(shot));
 }
@@ -132,23 +315,61 @@ PointModel ModelCapture::GenerateCombinedModel()
 		scan_settings_.cubePos[2]
 	);
 	
+	std::size_t totalPoints = 0;
+	for (const auto& model : currentModel)
+		totalPoints += model.points.size();
+
+	combinedModel.points.reserve(totalPoints);
+
+	//The camera sits at the origin of every shot, turned with the shot
+	combinedModel.viewpoints.resize(currentModel.size());
+	for (int i = 0; i < currentModel.size(); ++i)
+		combinedModel.viewpoints[i] = PointModel::RotatePoint(Point(0, 0, 0), centerPoint, singleTurn * (currentModel.size() - i - 1));
+
+	auto shotGrids = std::make_shared<std::vector<ShotGrid>>(currentModel.size());
+	for (int i = 0; i < currentModel.size(); ++i)
+	{
+		(*shotGrids)[i] = currentModel[i].grid;
+		(*shotGrids)[i].turn = singleTurn * (currentModel.size() - i - 1);
+		(*shotGrids)[i].center = centerPoint;
+	}
+	combinedModel.shotGrids = std::move(shotGrids);
+	combinedModel.frames = frameStore;
+
+	//The cube turns with the table around its own center, so it sweeps a cylinder around the Y axis
+	if (scan_settings_.cubeSet)
+	{
+		const float halfX = 0.1f * scan_settings_.cubeScale[0];
+		const float halfY = 0.1f * scan_settings_.cubeScale[1];
+		const float halfZ = 0.1f * scan_settings_.cubeScale[2];
+		const float radius = std::sqrt(halfX * halfX + halfZ * halfZ);
+
+		combinedModel.clipped = true;
+		combinedModel.clipMin = Point(centerPoint.x - radius, centerPoint.y - halfY, centerPoint.z - radius);
+		combinedModel.clipMax = Point(centerPoint.x + radius, centerPoint.y + halfY, centerPoint.z + radius);
+	}
+
 	//for (const auto& model : currentModel)
 	for (int i = 0; i < currentModel.size(); ++i)
 	{
 		if (!currentModel.at(i).points.empty())
 		{
-			const PointModel model = currentModel.at(i);
+			const PointModel& model = currentModel.at(i);
 
 			Point point;
 			Color color;
+			Vector normal;
+
+			const float turn = singleTurn * (currentModel.size() - i - 1);
 
 			//for(Point v : model.points)
 			for (int v = 0; v < model.points.size(); ++v)
 			{
-				point = model.RotateAroundPoint(v, centerPoint, singleTurn * (currentModel.size() - i - 1));
+				point = model.RotateAroundPoint(v, centerPoint, turn);
 				color = std::get<1>(model.points[v]);
+				normal = model.RotateNormal(v, turn);
 
-				combinedModel.AddPoint(point.x(), point.y(), point.z(), color[0], color[1], color[2]);
+				combinedModel.AddPoint(point.x(), point.y(), point.z(), color[0], color[1], color[2], normal, i);
 			}
 		}
 	}
@@ -165,7 +386,8 @@ ModelCapture::ModelCapture(Camera* camera) : camera_(camera), fileDialog(ImGuiFi
 	if (!serial_com_.GetAvailablePorts().empty())
 		serialPort = serial_com_.GetAvailablePorts()[0];
 	
-	fileDialog.SetTitle("Save mesh to");
+	fileDialog.SetTitle("Save point cloud to");
+	fileDialog.SetTypeFilters({ ".ply" });
 
 	meshGenerator.Init();
 }
@@ -247,7 +469,7 @@ void ModelCapture::RenderToTexture(float angle, float x, float y, float z) const
 		{
 			if (!currentModel.at(i).points.empty())
 			{
-				const PointModel model = currentModel.at(i);
+				const PointModel& model = currentModel.at(i);
 
 				Point point;
 				Color color;
@@ -334,11 +556,11 @@ void ModelCapture::RenderToTexturePreview(float angle, float x, float y, float z
 	//If the camera frame has updated 
 	if (lastFrameID != camera_->GetFrameID())
 	{
-		//Clear the last frames model
-		currentModel.clear();
+		//Clear the last frames model, the buffers are reused by the next frame
+		shotPool.ReleaseAll(currentModel);
 
 		//Get the new camera frame
-		GetCameraFrame();
+		GetCameraFrame(false);
 
 		//Render the camera frame to texture
 		RenderToTexture(angle, x, y, z);
@@ -364,6 +586,9 @@ void ModelCapture::Render(float angle, float x, float y, float z)
 			ImGui::DragInt("Number of Images:", &scan_settings_.numberOfImages, 1, 4, 255);
 			ImGui::DragFloat("Min Distance:", &scan_settings_.minDistance, 0.01f, 0.0f, 10.0f);
 			ImGui::DragFloat("Max Distance:", &scan_settings_.maxDistance, 0.01f, 0.0f, 10.0f);
+			ImGui::DragInt("Normal Pixel Step:", &scan_settings_.normalStep, 1, 1, 8);
+			ImGui::Text("Shot buffers: %d allocated, %d reused, %d pooled",
+				static_cast<int>(shotPool.GetAllocations()), static_cast<int>(shotPool.GetReuses()), static_cast<int>(shotPool.GetPooledCount()));
 
 			ImGui::Separator();
 			
@@ -440,7 +665,13 @@ void ModelCapture::Render(float angle, float x, float y, float z)
 						serial_com_.WriteChar(static_cast<char>(scan_settings_.numberOfImages));
 
 						if (!currentModel.empty())
-							currentModel.clear();
+							shotPool.ReleaseAll(currentModel);
+
+						//The last scan's shots are too small to be reused
+						shotPool.Trim();
+
+						//A new file, a running bake keeps the last scan's frames
+						frameStore = std::make_shared<FrameStore>(RGB_SENSOR_WIDTH, RGB_SENSOR_HEIGHT);
 
 						//Create a model shot for each shot
 						currentModel.reserve(scan_settings_.numberOfImages);
@@ -448,14 +679,16 @@ void ModelCapture::Render(float angle, float x, float y, float z)
 
 						scan_settings_.singleRotation = (360.f / scan_settings_.numberOfImages) * (M_PI / 180.f);
 
-						GetCameraFrame();
+						GetCameraFrame(true);
 						serial_com_.WriteChar('S');
 					}
 
 					if(ImGui::Button("Clear Scan"))
 					{
 						meshGenerator.Clear();
-						currentModel.clear();
+						shotPool.ReleaseAll(currentModel);
+						shotPool.Trim();
+						frameStore.reset();
 					}
 				}
 
@@ -534,6 +767,16 @@ void ModelCapture::Render(float angle, float x, float y, float z)
 				{
 					meshGenerator.RenderSettings();
 
+					if (ImGui::Button("Point Cloud Path"))
+						fileDialog.Open();
+
+					fileDialog.Display();
+					if (fileDialog.HasSelected())
+					{
+						meshGenerator.SetPointCloudPath(fileDialog.GetSelected().string());
+						fileDialog.ClearSelected();
+					}
+
 					if (ImGui::Button("Generate Model"))
 					{
 						//meshGenerator.Run(std::move(GenerateCombinedModel()));
@@ -543,6 +786,10 @@ void ModelCapture::Render(float angle, float x, float y, float z)
 					{
 						meshGeneratingFuture = std::async(std::launch::async, &MeshGenerator::GenerateMesh, &meshGenerator);
 					}
+					else if (ImGui::Button("Benchmark Neighbors"))
+					{
+						meshGeneratingFuture = std::async(std::launch::async, &MeshGenerator::BenchmarkNeighbors, &meshGenerator, GenerateCombinedModel());
+					}
 					else if (meshGenerator.ModelAvailable())
 					{
 						meshGenerator.RenderToTexture(angle, x, y, z);
@@ -550,7 +797,20 @@ void ModelCapture::Render(float angle, float x, float y, float z)
 					}					
 				}
 				else
-					ImGui::Text(meshGenerator.GetStatus().c_str());
+				{
+					const std::string status = meshGenerator.GetStatus();
+					ImGui::ProgressBar(meshGenerator.GetProgress(), ImVec2(-1, 0), status.c_str());
+
+					if (ImGui::Button("Cancel"))
+						meshGenerator.Cancel();
+
+					//Progress of the running stages
+					if (meshGenerator.ModelAvailable())
+					{
+						meshGenerator.RenderToTexture(angle, x, y, z);
+						ImGui::Image(reinterpret_cast<void*>(*meshGenerator.GetTexture()), ImVec2(DEPTH_SENSOR_WIDTH, DEPTH_SENSOR_HEIGHT), ImVec2(0, 1), ImVec2(1, 0));
+					}
+				}
 			}
 			ImGui::End();
 		}
@@ -598,7 +858,7 @@ void ModelCapture::ModelGatherTick(float time)
 
 					if(capturing)
 					{
-						GetCameraFrame();
+						GetCameraFrame(true);
 
 						//Tell the camera to turn
 						serial_com_.WriteChar('S');
@@ -613,7 +873,10 @@ void ModelCapture::ModelGatherTick(float time)
 					motorBusy = false;
 					capturing = false;
 
-					GetCameraFrame();
+					GetCameraFrame(true);
+
+					//Frees the frame sized buffers the scan used, the preview allocates its own again
+					shotPool.Trim();
 
 					//Reset turntable
 					serial_com_.WriteChar('R');
@@ -4,9 +4,11 @@
 #include <future>
 
 #include "Camera.h"
+#include "FrameStore.h"
 #include "imfilebrowser.h"
 #include "SerialCom.h"
 #include "MeshGenerator.h"
+#include "ShotPool.h"
 
 #define CGAL_NO_GMP 1
 
@@ -34,6 +36,9 @@ struct ScanSettings
 	float cubePos[3] = {0.024f, 0.07f, 1.188f};
 	float cubeScale[3] = {1.10f, 1.01f, 1.1f};
 
+	//Pixels between the depth grid neighbors used for the shot normals
+	int normalStep = 2;
+
 	bool overrideCenter = false;
 	float center[3] = { 0.03f, 0.07f, 1.14f };
 
@@ -69,6 +74,10 @@ class ModelCapture
 	
 	//Model
 	std::vector<PointModel> currentModel;
+	ShotPool shotPool;
+
+	//Color frames of the scanned shots
+	std::shared_ptr<FrameStore> frameStore;
 	bool hasIgnore;
 	int lastFrameID = -1;
 	int lastIgnoreFrameID = -1;
@@ -93,7 +102,14 @@ class ModelCapture
 	bool motorBusy = false;
 
 	//Gets the frame from the camera ignoring points outside of the Scan Settings
-	void GetCameraFrame();
+	//keepFrame stores the color frame of a scanned shot in the frame store
+	void GetCameraFrame(bool keepFrame);
+
+	//Normal of a depth pixel from its grid neighbors, facing the camera
+	bool GetShotNormal(const CameraSpacePoint* xyz, int index, Vector& normal) const;
+
+	//Keeps the shot's depth image and fits the pixel projection of its camera and its depth to color mapping
+	static void FillShotGrid(const CameraSpacePoint* xyz, const ColorSpacePoint* rgb, ShotGrid& grid);
 
 	void CreateIgnoreFrame();
 
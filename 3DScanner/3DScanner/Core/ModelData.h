@@ -6,6 +6,10 @@
 #include <CGAL/Poisson_reconstruction_function.h>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 // types
 typedef CGAL::Exact_predicates_inexact_constructions_kernel Kernel;
@@ -22,32 +26,233 @@ typedef Kernel::Sphere_3 Sphere;
 //typedef CGAL::Second_of_pair_property_map<CGAL::Second_of_pair_property_map<PointWithData>> NormalMap;
 
 typedef std::array<unsigned char, 3> Color;
-typedef std::tuple<Point, Color, Vector> PointWithData;
+//Position, color, normal and the shot the point was captured in (-1 unknown)
+typedef std::tuple<Point, Color, Vector, int> PointWithData;
 typedef CGAL::Nth_of_tuple_property_map<0, PointWithData> PointMap;
 typedef CGAL::Nth_of_tuple_property_map<1, PointWithData> ColorMap;
 typedef CGAL::Nth_of_tuple_property_map<2, PointWithData> NormalMap;
+typedef CGAL::Nth_of_tuple_property_map<3, PointWithData> ShotMap;
 
+//A tile of a tiled run also holds halo points that belong to its neighbors, they are marked by flipping this bit of the shot
+//The mark is set when the tile is written, so it follows the point through every stage wherever the point moves
+#define SHOT_HALO_BIT (1 << 30)
+
+inline bool IsHaloPoint(const PointWithData& point)
+{
+	//Unknown shots are negative and have the bit set until they are marked
+	const int shot = std::get<3>(point);
+	return ((shot & SHOT_HALO_BIT) != 0) != (shot < 0);
+}
+
+inline void MarkHaloPoint(PointWithData& point)
+{
+	if (!IsHaloPoint(point))
+		std::get<3>(point) ^= SHOT_HALO_BIT;
+}
+
+//Shot the point was captured in without the halo mark, stages read the shot through this
+inline int ShotIndex(const PointWithData& point)
+{
+	return IsHaloPoint(point) ? std::get<3>(point) ^ SHOT_HALO_BIT : std::get<3>(point);
+}
+
+//Integer cell of a regular grid a point falls in
+typedef std::array<std::int64_t, 3> CellKey;
+
+struct CellKeyHash
+{
+	std::size_t operator()(const CellKey& key) const
+	{
+		//Each component is mixed into the running hash, so swapped or mirrored keys do not collide
+		std::uint64_t hash = 0;
+		for (std::int64_t component : key)
+		{
+			hash = (hash ^ static_cast<std::uint64_t>(component)) * 0x9E3779B97F4A7C15ull;
+			hash ^= hash >> 32;
+		}
+		return static_cast<std::size_t>(hash);
+	}
+};
+
+inline CellKey GetCellKey(const Point& point, double cellSize)
+{
+	return {
+		static_cast<std::int64_t>(std::floor(point.x() / cellSize)),
+		static_cast<std::int64_t>(std::floor(point.y() / cellSize)),
+		static_cast<std::int64_t>(std::floor(point.z() / cellSize)) };
+}
+
+
+//Depth image of a shot, used to check points against what the camera saw
+struct ShotGrid
+{
+	int width = 0;
+	int height = 0;
+
+	//Millimeters per pixel, 0 = no reading
+	std::vector<std::uint16_t> depth;
+
+	//Pinhole fit of the sensor, u = p[0] * X / Z + p[1] and v = p[2] * Y / Z + p[3]
+	float projection[4] = { 0, 0, 0, 0 };
+
+	//Depth to color mapping fit, u = c[0] * X / Z + c[1] / Z + c[2] and v = c[3] * Y / Z + c[4] / Z + c[5]
+	//The 1 / Z terms take the color camera's offset from the depth camera
+	float colorProjection[6] = { 0, 0, 0, 0, 0, 0 };
+
+	//Color frame of the shot in the scan's FrameStore, -1 none kept
+	int frame = -1;
+
+	//Turntable rotation of the shot in the combined model
+	float turn = 0;
+	glm::vec3 center = glm::vec3(0);
+
+	//Pixel a camera space position lands on
+	bool Project(const glm::vec3& position, int& x, int& y) const
+	{
+		if (position.z <= 0)
+			return false;
+
+		x = static_cast<int>(std::floor(projection[0] * position.x / position.z + projection[1] + 0.5f));
+		y = static_cast<int>(std::floor(projection[2] * position.y / position.z + projection[3] + 0.5f));
+
+		return x >= 0 && y >= 0 && x < width && y < height;
+	}
+
+	//Color frame position of a camera space position, not clamped to the frame
+	bool ProjectColor(const glm::vec3& position, float& u, float& v) const
+	{
+		if (position.z <= 0)
+			return false;
+
+		u = colorProjection[0] * position.x / position.z + colorProjection[1] / position.z + colorProjection[2];
+		v = colorProjection[3] * position.y / position.z + colorProjection[4] / position.z + colorProjection[5];
+
+		return true;
+	}
+};
+
+//Triangle mesh as flat arrays, xyz per vertex and three vertex indices per triangle
+struct IndexedMesh
+{
+	std::vector<float> vertices;
+	std::vector<std::uint32_t> triangles;
+
+	//rgb per vertex, empty until colors are transferred onto the mesh
+	std::vector<unsigned char> colors;
+
+	//uv pairs and three of them per triangle, empty until a texture is baked
+	std::vector<float> texcoords;
+	std::vector<std::uint32_t> texcoordIndices;
+
+	std::size_t VertexCount() const { return vertices.size() / 3; }
+	std::size_t TriangleCount() const { return triangles.size() / 3; }
+
+	void Clear()
+	{
+		vertices.clear();
+		triangles.clear();
+		colors.clear();
+		texcoords.clear();
+		texcoordIndices.clear();
+	}
+
+	//Area weighted unit normal of every vertex, xyz per vertex
+	void VertexNormals(std::vector<float>& normals) const
+	{
+		//Face normals summed unnormalized, so bigger faces count more
+		normals.assign(vertices.size(), 0);
+
+		for (std::size_t f = 0; f < TriangleCount(); ++f)
+		{
+			const std::uint32_t* face = &triangles[f * 3];
+			const float* a = &vertices[face[0] * 3];
+			const float* b = &vertices[face[1] * 3];
+			const float* c = &vertices[face[2] * 3];
+
+			const float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			const float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			const float n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				for (int axis = 0; axis < 3; ++axis)
+					normals[face[corner] * 3 + axis] += n[axis];
+			}
+		}
+
+		for (std::size_t v = 0; v < VertexCount(); ++v)
+		{
+			float* n = &normals[v * 3];
+			const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			if (length > 0)
+			{
+				n[0] /= length;
+				n[1] /= length;
+				n[2] /= length;
+			}
+		}
+	}
+};
+
+//RGB image, rows from the top
+struct TextureImage
+{
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> rgb;
+};
+
+class FrameStore;
 
 struct PointModel
 {
 	std::vector<PointWithData> points;
 
+	//Camera position of every shot in the model's frame, indexed by the point's shot
+	std::vector<Point> viewpoints;
+
+	//Depth image of a single captured shot
+	ShotGrid grid;
+
+	//Depth images of every shot of a combined model, shared by its copies and tiles
+	std::shared_ptr<const std::vector<ShotGrid>> shotGrids;
+
+	//Color frames of the scan the shot grids point into, for texture baking
+	std::shared_ptr<FrameStore> frames;
+
+	//Box holding everything the clip cube let through in any shot, in the model's frame
+	bool clipped = false;
+	Point clipMin;
+	Point clipMax;
+
 	void AddPoint(float x, float y, float z, unsigned char r, unsigned char g, unsigned char b)
 	{
 	//	points.push_back(std::make_pair<Point, ColorNormal>(Point(x, y, z), std::make_pair<Point, Vector>(Point(r, g, b), Vector())));
-		points.emplace_back(Point(x, y, z), Color({ r,g,b }), Vector());
+		points.emplace_back(Point(x, y, z), Color({ r,g,b }), Vector(), -1);
+	}
+
+	void AddPoint(float x, float y, float z, unsigned char r, unsigned char g, unsigned char b, const Vector& normal, int shot = -1)
+	{
+		points.emplace_back(Point(x, y, z), Color({ r,g,b }), normal, shot);
 	}
 
 	//Rotate this vertex around a point
 	Point RotateAroundPoint(int index, glm::vec3 point, float radian) const
+	{
+		return RotatePoint(std::get<0>(points[index]), point, radian);
+	}
+
+	//Rotate any position around a point, about the turntable's (Y) axis
+	static Point RotatePoint(const Point& vertex, glm::vec3 point, float radian)
 	{
 		if (radian == 0.0f)
-			return std::get<0>(points[index]);
+			return vertex;
 
 		glm::vec3 position(
-			std::get<0>(points[index]).x(),
-			std::get<0>(points[index]).y(),
-			std::get<0>(points[index]).z());
+			vertex.x(),
+			vertex.y(),
+			vertex.z());
 		const glm::vec3 offset = position - point;
 
 		float s = glm::sin(radian);
@@ -64,4 +269,21 @@ struct PointModel
 		return Point(rotatedPos.x, rotatedPos.y, rotatedPos.z);
 	}
 
+	//Rotate this vertex's normal by the same turn as RotateAroundPoint
+	Vector RotateNormal(int index, float radian) const
+	{
+		const Vector& normal = std::get<2>(points[index]);
+
+		if (radian == 0.0f)
+			return normal;
+
+		const double s = std::sin(radian);
+		const double c = std::cos(radian);
+
+		return Vector(
+			normal.x() * c - normal.z() * s,
+			normal.y(),
+			normal.x() * s + normal.z() * c);
+	}
+
 };
\ No newline at end of file
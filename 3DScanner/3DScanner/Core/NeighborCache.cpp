@@ -0,0 +1,174 @@
+#include "NeighborCache.h"
+
+#include <algorithm>
+#include <cmath>
+
+void NeighborCache::BuildTree()
+{
+	const PositionMap positionMap(positions.data());
+
+	tree = std::make_unique<Tree>(
+		boost::counting_iterator<std::size_t>(0),
+		boost::counting_iterator<std::size_t>(positions.size()),
+		Tree::Splitter(),
+		TreeTraits(positionMap));
+
+	//Build now so searching never triggers a build
+	tree->build();
+
+	indexStale = false;
+}
+
+void NeighborCache::BuildLists(unsigned int k, ThreadPool& pool)
+{
+	const std::size_t stride = k + 1;
+	neighbors.assign(positions.size() * stride, 0);
+
+	if (useGrid)
+	{
+		//Voxels sized so the first shell around a point holds about k points
+		const float pointsPerCell = std::max(8.0f, k / 3.0f);
+
+		if (indexStale || grid.Size() != positions.size() || grid.pointsPerCell != pointsPerCell)
+		{
+			grid.pointsPerCell = pointsPerCell;
+			grid.Build(positions, pool);
+			indexStale = false;
+		}
+
+		grid.QueryAll(k, neighbors.data(), pool);
+		cachedK = k;
+		return;
+	}
+
+	if (indexStale || !tree)
+		BuildTree();
+
+	const PositionMap positionMap(positions.data());
+
+	//The tree is already built so searching is read only
+	pool.ParallelFor(positions.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			NeighborSearch search(*tree, positions[i], k + 1, 0, true, Distance(positionMap));
+
+			std::uint32_t* out = &neighbors[i * stride];
+			std::size_t found = 0;
+
+			for (auto it = search.begin(); it != search.end() && found < stride; ++it, ++found)
+				out[found] = static_cast<std::uint32_t>(it->first);
+
+			//Less points than k, repeat the furthest one so every list has the same length
+			for (; found < stride; ++found)
+				out[found] = found > 0 ? out[found - 1] : static_cast<std::uint32_t>(i);
+		}
+	});
+
+	cachedK = k;
+}
+
+void NeighborCache::Prepare(const std::vector<PointWithData>& points, unsigned int version, unsigned int k, ThreadPool& pool)
+{
+	if (!valid || builtVersion != version || positions.size() != points.size())
+	{
+		positions.resize(points.size());
+		for (std::size_t i = 0; i < points.size(); ++i)
+			positions[i] = std::get<0>(points[i]);
+
+		tree.reset();
+		grid.Clear();
+		cachedK = 0;
+		builtVersion = version;
+		valid = true;
+	}
+
+	if (positions.empty())
+		return;
+
+	//Lists are sorted so a smaller k is a prefix of the cached lists
+	if (k > cachedK)
+		BuildLists(k, pool);
+}
+
+void NeighborCache::PointsMoved(const std::vector<PointWithData>& points, unsigned int version, float averageSpacing, ThreadPool& pool)
+{
+	if (!valid || positions.size() != points.size())
+	{
+		Clear();
+		return;
+	}
+
+	std::vector<FT> chunkMove(ThreadPool::ChunkCount(points.size(), PARALLEL_GRAIN), 0);
+
+	pool.ParallelFor(points.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		FT move = 0;
+		for (std::size_t i = begin; i < end; ++i)
+			move = std::max(move, CGAL::squared_distance(positions[i], std::get<0>(points[i])));
+
+		chunkMove[begin / PARALLEL_GRAIN] = move;
+	});
+
+	const FT maxMove = chunkMove.empty() ? 0 : *std::max_element(chunkMove.begin(), chunkMove.end());
+
+	const FT tolerance = moveTolerance * averageSpacing;
+
+	//Moved too far, neighborhoods might have changed
+	if (std::sqrt(maxMove) > tolerance)
+	{
+		Clear();
+		return;
+	}
+
+	for (std::size_t i = 0; i < points.size(); ++i)
+		positions[i] = std::get<0>(points[i]);
+
+	//Keep the neighbor lists, the index is only rebuilt if a bigger k is asked for
+	builtVersion = version;
+	indexStale = true;
+}
+
+void NeighborCache::Clear()
+{
+	positions.clear();
+	neighbors.clear();
+	tree.reset();
+	grid.Clear();
+	cachedK = 0;
+	valid = false;
+	indexStale = false;
+}
+
+FT NeighborCache::AverageSpacing(unsigned int k, ThreadPool& pool) const
+{
+	if (positions.empty() || k > cachedK)
+		return 0;
+
+	//Summed per chunk then in chunk order so the result does not depend on the thread count
+	std::vector<FT> chunkSum(ThreadPool::ChunkCount(positions.size(), PARALLEL_GRAIN), 0);
+
+	pool.ParallelFor(positions.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		FT sum = 0;
+
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const std::uint32_t* list = Neighbors(i);
+
+			FT distances = 0;
+			for (unsigned int n = 0; n <= k; ++n)
+				distances += std::sqrt(CGAL::squared_distance(positions[i], positions[list[n]]));
+
+			sum += distances / (k + 1);
+		}
+
+		chunkSum[begin / PARALLEL_GRAIN] = sum;
+	});
+
+	FT sum = 0;
+	for (FT chunk : chunkSum)
+		sum += chunk;
+
+	return sum / positions.size();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "KnnGrid.h"
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <CGAL/Search_traits_3.h>
+#include <CGAL/Search_traits_adapter.h>
+#include <CGAL/Orthogonal_k_neighbor_search.h>
+#include <CGAL/property_map.h>
+#include <boost/iterator/counting_iterator.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//One spatial index plus the k nearest neighbor lists of every point
+//Built once per point set version and shared by all the point processing stages
+class NeighborCache
+{
+	typedef CGAL::Pointer_property_map<Point>::const_type PositionMap;
+	typedef CGAL::Search_traits_3<Kernel> BaseTraits;
+	typedef CGAL::Search_traits_adapter<std::size_t, PositionMap, BaseTraits> TreeTraits;
+	typedef CGAL::Orthogonal_k_neighbor_search<TreeTraits> NeighborSearch;
+	typedef NeighborSearch::Tree Tree;
+	typedef NeighborSearch::Distance Distance;
+
+	//Copy of the positions the index was built on
+	std::vector<Point> positions;
+	std::unique_ptr<Tree> tree;
+	KnnGrid grid;
+
+	//Flat neighbor lists, (cachedK + 1) entries per point sorted by distance, the point itself included
+	std::vector<std::uint32_t> neighbors;
+	unsigned int cachedK = 0;
+
+	//Point set version the lists belong to
+	unsigned int builtVersion = 0;
+	bool valid = false;
+
+	//Points moved since the index was built, the neighbor lists are still usable
+	bool indexStale = false;
+
+	void BuildTree();
+	void BuildLists(unsigned int k, ThreadPool& pool);
+
+public:
+
+	//Use the voxel grid search instead of the CGAL kd-tree
+	bool useGrid = true;
+
+	//How far points may move (relative to the average spacing) before the neighbor lists are rebuilt
+	float moveTolerance = 0.25f;
+
+	//Makes sure the cache holds at least k neighbors for this version of the point set
+	void Prepare(const std::vector<PointWithData>& points, unsigned int version, unsigned int k, ThreadPool& pool);
+
+	//Points only moved, keeps the neighbor lists if the move was small enough
+	void PointsMoved(const std::vector<PointWithData>& points, unsigned int version, float averageSpacing, ThreadPool& pool);
+
+	//Drops everything, the next Prepare rebuilds from scratch
+	void Clear();
+
+	//The k + 1 nearest points (the point itself included) sorted by distance, CachedK() + 1 entries
+	const std::uint32_t* Neighbors(std::size_t index) const { return &neighbors[index * (cachedK + 1)]; }
+
+	unsigned int CachedK() const { return cachedK; }
+
+	std::size_t Size() const { return positions.size(); }
+
+	const Point& Position(std::size_t index) const { return positions[index]; }
+
+	//Same value as CGAL::compute_average_spacing, using the cached lists
+	FT AverageSpacing(unsigned int k, ThreadPool& pool) const;
+};
@@ -1,61 +1,92 @@
 #pragma once
 
-#include <CGAL/boost/graph/Named_function_parameters.h>
-#include <CGAL/boost/graph/named_params_helper.h>
-#include <CGAL/property_map.h>
-#include <boost/graph/graph_traits.hpp>
-
-#include <CGAL/basic.h>
-#include <CGAL/Inverse_index.h>
-#include <CGAL/IO/File_writer_wavefront.h>
+#include <cstdio>
 #include <iostream>
+#include <string>
 
+#include "ModelData.h"
+
+//Writes a mesh as Wavefront OBJ, same layout as CGAL::File_writer_wavefront
+//Lines are formatted into a large buffer and written in chunks instead of one stream call per number
 class OBJ_Writer
 {
-public:
-	template <class Polyhedron>
-	static void PrintObj(std::ostream& out, const Polyhedron& p);
+	//Bytes formatted before they are handed to the stream
+	static const std::size_t ChunkSize = 1 << 20;
 
-	template<class Polyhedron, class Vpm>
-	static void PrintObj(std::ostream& out, const Polyhedron& p, const Vpm& vpm);
+public:
+	//material names the texture's material in mtllib when the mesh has texcoords
+	static void PrintObj(std::ostream& out, const IndexedMesh& mesh, const std::string& mtllib = "", const std::string& material = "");
 };
 
-template <class Polyhedron>
-void OBJ_Writer::PrintObj(std::ostream& out, const Polyhedron& p)
+inline void OBJ_Writer::PrintObj(std::ostream& out, const IndexedMesh& mesh, const std::string& mtllib, const std::string& material)
 {
-	PrintObj(out, p, get(CGAL::vertex_point, p));
-}
+	const bool textured = !mtllib.empty() && mesh.texcoordIndices.size() == mesh.triangles.size();
 
-template <class Polyhedron, class Vpm>
-void OBJ_Writer::PrintObj(std::ostream& out, const Polyhedron& P, const Vpm& vpm)
-{
-	CGAL::File_writer_wavefront writer;
-
-	// writes P to `out' in the format provided by `writer'.
-	typedef typename Polyhedron::Vertex_const_iterator                  VCI;
-	typedef typename Polyhedron::Facet_const_iterator                   FCI;
-	typedef typename Polyhedron::Halfedge_around_facet_const_circulator HFCC;
-
-    for (typename boost::graph_traits<Polyhedron>::vertex_descriptor vi : vertices(P)) {
-        writer.write_vertex(::CGAL::to_double(get(vpm, vi).x()),
-            ::CGAL::to_double(get(vpm, vi).y()),
-            ::CGAL::to_double(get(vpm, vi).z()));
-    }
-    typedef CGAL::Inverse_index< VCI> Index;
-    Index index(P.vertices_begin(), P.vertices_end());
-    writer.write_facet_header();
-
-    for (FCI fi = P.facets_begin(); fi != P.facets_end(); ++fi) {
-        HFCC hc = fi->facet_begin();
-        HFCC hc_end = hc;
-        std::size_t n = circulator_size(hc);
-        CGAL_assertion(n >= 3);
-        writer.write_facet_begin(n);
-        do {
-            writer.write_facet_vertex_index(index[VCI(hc->vertex())]);
-            ++hc;
-        } while (hc != hc_end);
-        writer.write_facet_end();
-    }
-    writer.write_footer();
+	std::string buffer;
+	buffer.reserve(ChunkSize + 128);
+
+	char line[128];
+
+	auto flush = [&](bool force)
+	{
+		if (force || buffer.size() >= ChunkSize)
+		{
+			out.write(buffer.data(), buffer.size());
+			buffer.clear();
+		}
+	};
+
+	int length = std::snprintf(line, sizeof(line), "# file written from a CGAL tool in Wavefront obj format\n# %zu vertices\n# %zu halfedges\n# %zu facets\n\n",
+		mesh.VertexCount(), mesh.TriangleCount() * 3, mesh.TriangleCount());
+	buffer.append(line, length);
+
+	if (textured)
+		buffer.append("mtllib ").append(mtllib).append("\n");
+
+	buffer.append("\n# ").append(std::to_string(mesh.VertexCount())).append(" vertices\n# ------------------------------------------\n\n");
+
+	for (std::size_t v = 0; v < mesh.VertexCount(); ++v)
+	{
+		length = std::snprintf(line, sizeof(line), "v %g %g %g\n", mesh.vertices[v * 3], mesh.vertices[v * 3 + 1], mesh.vertices[v * 3 + 2]);
+		buffer.append(line, length);
+		flush(false);
+	}
+
+	if (textured)
+	{
+		buffer.append("\n");
+		for (std::size_t t = 0; t < mesh.texcoords.size() / 2; ++t)
+		{
+			length = std::snprintf(line, sizeof(line), "vt %g %g\n", mesh.texcoords[t * 2], mesh.texcoords[t * 2 + 1]);
+			buffer.append(line, length);
+			flush(false);
+		}
+
+		buffer.append("\nusemtl ").append(material).append("\n");
+	}
+
+	buffer.append("\n# ").append(std::to_string(mesh.TriangleCount())).append(" facets\n# ------------------------------------------\n\n");
+
+	//OBJ indices start at 1
+	for (std::size_t f = 0; f < mesh.TriangleCount(); ++f)
+	{
+		const std::uint32_t* face = &mesh.triangles[f * 3];
+
+		if (textured)
+		{
+			const std::uint32_t* texcoord = &mesh.texcoordIndices[f * 3];
+			length = std::snprintf(line, sizeof(line), "f %u/%u %u/%u %u/%u\n",
+				face[0] + 1, texcoord[0] + 1, face[1] + 1, texcoord[1] + 1, face[2] + 1, texcoord[2] + 1);
+		}
+		else
+		{
+			length = std::snprintf(line, sizeof(line), "f %u %u %u\n", face[0] + 1, face[1] + 1, face[2] + 1);
+		}
+
+		buffer.append(line, length);
+		flush(false);
+	}
+
+	buffer.append("\n# End of Wavefront obj format #\n");
+	flush(true);
 }
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ModelData.h"
+
+//Writes point clouds and meshes as PLY, binary little endian or ASCII
+//Records are packed into a large buffer and written in chunks instead of one stream call per property
+//Binary records are copied as they are in memory, every supported target is little endian
+class PLY_Writer
+{
+	//Bytes packed before they are handed to the stream
+	static const std::size_t ChunkSize = 1 << 20;
+
+	//Largest ASCII or binary record
+	static const std::size_t RecordSize = 256;
+
+	class Buffer
+	{
+		std::ostream& out;
+		std::string data;
+
+	public:
+		explicit Buffer(std::ostream& out) : out(out) { data.reserve(ChunkSize + RecordSize); }
+
+		void Append(const void* bytes, std::size_t size) { data.append(static_cast<const char*>(bytes), size); }
+		void Append(const std::string& text) { data.append(text); }
+
+		void Flush(bool force)
+		{
+			if (force || data.size() >= ChunkSize)
+			{
+				out.write(data.data(), data.size());
+				data.clear();
+			}
+		}
+	};
+
+	template<typename T>
+	static std::size_t Pack(char* record, const T& value)
+	{
+		std::memcpy(record, &value, sizeof(T));
+		return sizeof(T);
+	}
+
+	static void PrintHeader(Buffer& buffer, bool binary)
+	{
+		buffer.Append(std::string("ply\nformat ") + (binary ? "binary_little_endian" : "ascii") + " 1.0\n");
+	}
+
+public:
+	//x y z, nx ny nz and red green blue per point, the coordinates as float unless doublePrecision
+	static void PrintPoints(std::ostream& out, const std::vector<PointWithData>& points, bool binary = true, bool doublePrecision = false);
+
+	//x y z and red green blue when the mesh has colors, a uchar counted uint list per face
+	static void PrintMesh(std::ostream& out, const IndexedMesh& mesh, bool binary = true);
+};
+
+inline void PLY_Writer::PrintPoints(std::ostream& out, const std::vector<PointWithData>& points, bool binary, bool doublePrecision)
+{
+	Buffer buffer(out);
+	PrintHeader(buffer, binary);
+
+	const std::string type = doublePrecision ? "double" : "float";
+	buffer.Append("element vertex " + std::to_string(points.size()) + "\n");
+	for (const char* property : { "x", "y", "z", "nx", "ny", "nz" })
+		buffer.Append("property " + type + " " + property + "\n");
+	buffer.Append("property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n");
+
+	char record[RecordSize];
+
+	for (const PointWithData& point : points)
+	{
+		const Point& p = std::get<0>(point);
+		const Color& c = std::get<1>(point);
+		const Vector& n = std::get<2>(point);
+
+		std::size_t length = 0;
+
+		if (!binary)
+		{
+			const char* format = doublePrecision ? "%.17g %.17g %.17g %.17g %.17g %.17g %d %d %d\n" : "%.9g %.9g %.9g %.9g %.9g %.9g %d %d %d\n";
+			length = std::snprintf(record, sizeof(record), format,
+				p.x(), p.y(), p.z(), n.x(), n.y(), n.z(), int(c[0]), int(c[1]), int(c[2]));
+		}
+		else if (doublePrecision)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+				length += Pack(record + length, static_cast<double>(p[axis]));
+			for (int axis = 0; axis < 3; ++axis)
+				length += Pack(record + length, static_cast<double>(n[axis]));
+		}
+		else
+		{
+			for (int axis = 0; axis < 3; ++axis)
+				length += Pack(record + length, static_cast<float>(p[axis]));
+			for (int axis = 0; axis < 3; ++axis)
+				length += Pack(record + length, static_cast<float>(n[axis]));
+		}
+
+		if (binary)
+		{
+			std::memcpy(record + length, c.data(), 3);
+			length += 3;
+		}
+
+		buffer.Append(record, length);
+		buffer.Flush(false);
+	}
+
+	buffer.Flush(true);
+}
+
+inline void PLY_Writer::PrintMesh(std::ostream& out, const IndexedMesh& mesh, bool binary)
+{
+	Buffer buffer(out);
+	PrintHeader(buffer, binary);
+
+	const bool colored = mesh.colors.size() == mesh.vertices.size();
+
+	buffer.Append("element vertex " + std::to_string(mesh.VertexCount()) + "\n"
+		"property float x\nproperty float y\nproperty float z\n");
+	if (colored)
+		buffer.Append("property uchar red\nproperty uchar green\nproperty uchar blue\n");
+	buffer.Append("element face " + std::to_string(mesh.TriangleCount()) + "\n"
+		"property list uchar uint vertex_indices\nend_header\n");
+
+	char record[RecordSize];
+
+	for (std::size_t v = 0; v < mesh.VertexCount(); ++v)
+	{
+		const float* position = &mesh.vertices[v * 3];
+		std::size_t length = 0;
+
+		if (binary)
+		{
+			std::memcpy(record, position, 3 * sizeof(float));
+			length = 3 * sizeof(float);
+
+			if (colored)
+			{
+				std::memcpy(record + length, &mesh.colors[v * 3], 3);
+				length += 3;
+			}
+		}
+		else if (colored)
+		{
+			const unsigned char* color = &mesh.colors[v * 3];
+			length = std::snprintf(record, sizeof(record), "%.9g %.9g %.9g %d %d %d\n",
+				position[0], position[1], position[2], int(color[0]), int(color[1]), int(color[2]));
+		}
+		else
+		{
+			length = std::snprintf(record, sizeof(record), "%.9g %.9g %.9g\n", position[0], position[1], position[2]);
+		}
+
+		buffer.Append(record, length);
+		buffer.Flush(false);
+	}
+
+	for (std::size_t f = 0; f < mesh.TriangleCount(); ++f)
+	{
+		const std::uint32_t* face = &mesh.triangles[f * 3];
+		std::size_t length = 0;
+
+		if (binary)
+		{
+			record[0] = 3;
+			std::memcpy(record + 1, face, 3 * sizeof(std::uint32_t));
+			length = 1 + 3 * sizeof(std::uint32_t);
+		}
+		else
+		{
+			length = std::snprintf(record, sizeof(record), "3 %u %u %u\n", face[0], face[1], face[2]);
+		}
+
+		buffer.Append(record, length);
+		buffer.Flush(false);
+	}
+
+	buffer.Flush(true);
+}
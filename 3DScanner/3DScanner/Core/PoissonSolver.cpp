@@ -0,0 +1,671 @@
+#include "PoissonSolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//Cells per axis of the coarsest level, 2^4
+#define POISSON_COARSEST_DEPTH 4
+
+//Levels up to this depth store every brick, 2^7 cells per axis take about 70 MB while solving
+#define POISSON_DENSE_DEPTH 7
+
+//The coarsest level is small enough to be solved to convergence
+#define POISSON_COARSEST_ITERATIONS 500
+#define POISSON_COARSEST_TOLERANCE 1e-6
+
+//Relative residual at which the finer levels have converged, they start from the coarser solution so only the detail is left
+#define POISSON_TOLERANCE 1e-3
+
+//Bricks handled per chunk
+#define POISSON_BRICK_GRAIN 64
+
+//Value the screening pulls the function to at the points
+//The normal field makes the function step by about 1 across the surface, from -1 inside to the border's 0 outside
+//Pulling to the middle of the step instead of 0 keeps the outside from being flattened onto the border value
+#define POISSON_SCREENING_TARGET -0.5f
+
+void PoissonSolver::Clear()
+{
+	levels.clear();
+	levels.shrink_to_fit();
+	size = 0;
+	outsideValue = 1;
+}
+
+std::size_t PoissonSolver::GetNodeCount() const
+{
+	std::size_t count = 0;
+	for (const Level& level : levels)
+		count += level.x.size();
+
+	return count;
+}
+
+double PoissonSolver::SlotSum(std::size_t slots, ThreadPool& pool, const std::function<double(std::size_t)>& func)
+{
+	std::vector<double> sums(ThreadPool::ChunkCount(slots, POISSON_BRICK_GRAIN), 0);
+
+	pool.ParallelFor(slots, POISSON_BRICK_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		double sum = 0;
+		for (std::size_t slot = begin; slot < end; ++slot)
+			sum += func(slot);
+
+		sums[begin / POISSON_BRICK_GRAIN] = sum;
+	});
+
+	double sum = 0;
+	for (double value : sums)
+		sum += value;
+
+	return sum;
+}
+
+bool PoissonSolver::InDomain(const Point& position) const
+{
+	if (!bounded)
+		return true;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (position[axis] < boundMin[axis] || position[axis] > boundMax[axis])
+			return false;
+	}
+
+	return true;
+}
+
+bool PoissonSolver::GridPosition(const Level& level, const Point& position, double* grid) const
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		grid[axis] = (position[axis] - origin[axis]) / level.cellSize;
+		if (!(grid[axis] >= 0 && grid[axis] <= level.cells))
+			return false;
+	}
+
+	return true;
+}
+
+void PoissonSolver::Activate(const std::vector<PointWithData>& points, bool dense, Level& level) const
+{
+	const std::size_t b = static_cast<std::size_t>(level.bricks);
+	std::vector<char> used(b * b * b, dense ? 1 : 0);
+
+	if (!dense)
+	{
+		//Bricks holding a corner of a sample's cell
+		std::vector<char> touched(used.size(), 0);
+
+		for (const auto& point : points)
+		{
+			const Point& position = std::get<0>(point);
+
+			double grid[3];
+			if (!GridPosition(level, position, grid) || !InDomain(position))
+				continue;
+
+			int low[3];
+			int high[3];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const int base = std::min(static_cast<int>(grid[axis]), level.cells - 1);
+				low[axis] = base / POISSON_BRICK;
+				high[axis] = (base + 1) / POISSON_BRICK;
+			}
+
+			for (int z = low[2]; z <= high[2]; ++z)
+				for (int y = low[1]; y <= high[1]; ++y)
+					for (int x = low[0]; x <= high[0]; ++x)
+						touched[(z * b + y) * b + x] = 1;
+		}
+
+		//One brick of margin, so the nodes the coarser level holds fixed are away from the samples
+		for (int z = 0; z < level.bricks; ++z)
+		{
+			for (int y = 0; y < level.bricks; ++y)
+			{
+				for (int x = 0; x < level.bricks; ++x)
+				{
+					if (!touched[(z * b + y) * b + x])
+						continue;
+
+					for (int dz = std::max(z - 1, 0); dz <= std::min(z + 1, level.bricks - 1); ++dz)
+						for (int dy = std::max(y - 1, 0); dy <= std::min(y + 1, level.bricks - 1); ++dy)
+							for (int dx = std::max(x - 1, 0); dx <= std::min(x + 1, level.bricks - 1); ++dx)
+								used[(dz * b + dy) * b + dx] = 1;
+				}
+			}
+		}
+	}
+
+	//Slots in brick order, so the layout does not depend on the points' order
+	level.slotOf.assign(used.size(), -1);
+	level.brickOf.clear();
+
+	for (int z = 0; z < level.bricks; ++z)
+	{
+		for (int y = 0; y < level.bricks; ++y)
+		{
+			for (int x = 0; x < level.bricks; ++x)
+			{
+				const std::size_t brick = (z * b + y) * b + x;
+				if (!used[brick])
+					continue;
+
+				level.slotOf[brick] = static_cast<std::int32_t>(level.brickOf.size());
+				level.brickOf.push_back({ { x, y, z } });
+			}
+		}
+	}
+
+	level.neighbors.resize(level.brickOf.size());
+
+	for (std::size_t slot = 0; slot < level.brickOf.size(); ++slot)
+	{
+		const std::array<int, 3>& brick = level.brickOf[slot];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			for (int side = 0; side < 2; ++side)
+			{
+				int next[3] = { brick[0], brick[1], brick[2] };
+				next[axis] += side ? 1 : -1;
+
+				const bool inside = next[axis] >= 0 && next[axis] < level.bricks;
+				level.neighbors[slot][axis * 2 + side] = inside ? level.slotOf[(next[2] * b + next[1]) * b + next[0]] : -1;
+			}
+		}
+	}
+
+	level.x.assign(level.brickOf.size() * POISSON_BRICK_NODES, 0);
+}
+
+void PoissonSolver::Splat(const std::vector<PointWithData>& points, float averageSpacing, const Level& level,
+	std::vector<float>* field, std::vector<float>& weight, ThreadPool& pool) const
+{
+	const std::size_t total = level.x.size();
+
+	for (int axis = 0; axis < 3; ++axis)
+		field[axis].assign(total, 0);
+	weight.assign(total, 0);
+
+	//Surface area every point stands for, in cells
+	const float area = averageSpacing > 0 ? static_cast<float>((averageSpacing / level.cellSize) * (averageSpacing / level.cellSize)) : 1.0f;
+
+	//Points are bucketed by brick layer along z, a layer only writes its own nodes and the next layer's first plane
+	//so every other layer can run at once
+	std::vector<int> layerOf(points.size());
+	std::vector<std::uint32_t> layerStart(level.bricks + 1, 0);
+
+	for (std::size_t i = 0; i < points.size(); ++i)
+	{
+		const double z = (std::get<0>(points[i]).z() - origin.z()) / level.cellSize;
+		layerOf[i] = (z < 0 || z > level.cells) ? -1 : std::min(static_cast<int>(z), level.cells - 1) / POISSON_BRICK;
+
+		if (layerOf[i] >= 0)
+			++layerStart[layerOf[i] + 1];
+	}
+
+	for (int layer = 0; layer < level.bricks; ++layer)
+		layerStart[layer + 1] += layerStart[layer];
+
+	std::vector<std::uint32_t> order(layerStart[level.bricks]);
+	{
+		std::vector<std::uint32_t> next(layerStart.begin(), layerStart.end() - 1);
+		for (std::size_t i = 0; i < points.size(); ++i)
+		{
+			if (layerOf[i] >= 0)
+				order[next[layerOf[i]]++] = static_cast<std::uint32_t>(i);
+		}
+	}
+
+	for (int parity = 0; parity < 2; ++parity)
+	{
+		pool.ParallelFor((level.bricks - parity + 1) / 2, 1, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t s = begin; s < end; ++s)
+			{
+				const int layer = static_cast<int>(s) * 2 + parity;
+
+				for (std::uint32_t o = layerStart[layer]; o < layerStart[layer + 1]; ++o)
+				{
+					const Point& position = std::get<0>(points[order[o]]);
+					const Vector& normal = std::get<2>(points[order[o]]);
+
+					const double length = std::sqrt(normal.squared_length());
+					if (length == 0)
+						continue;
+
+					double grid[3];
+					if (!GridPosition(level, position, grid) || !InDomain(position))
+						continue;
+
+					int base[3];
+					float fraction[3];
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						base[axis] = std::min(static_cast<int>(grid[axis]), level.cells - 1);
+						fraction[axis] = static_cast<float>(grid[axis] - base[axis]);
+					}
+
+					const float n[3] = {
+						static_cast<float>(normal.x() / length),
+						static_cast<float>(normal.y() / length),
+						static_cast<float>(normal.z() / length) };
+
+					for (int corner = 0; corner < 8; ++corner)
+					{
+						const int dx = corner & 1;
+						const int dy = (corner >> 1) & 1;
+						const int dz = corner >> 2;
+
+						const float w = area *
+							(dx ? fraction[0] : 1 - fraction[0]) *
+							(dy ? fraction[1] : 1 - fraction[1]) *
+							(dz ? fraction[2] : 1 - fraction[2]);
+
+						//Activate stored every brick a sample's cell touches
+						const std::size_t index = level.Node(base[0] + dx, base[1] + dy, base[2] + dz);
+						for (int axis = 0; axis < 3; ++axis)
+							field[axis][index] += n[axis] * w;
+						weight[index] += w;
+					}
+				}
+			}
+		});
+	}
+}
+
+bool PoissonSolver::SolveLevel(Level& level, std::vector<float>* field, const std::vector<float>& weight,
+	int maxIterations, double tolerance, ThreadPool& pool) const
+{
+	const std::size_t slots = level.SlotCount();
+	const std::size_t total = level.x.size();
+	std::vector<float>& x = level.x;
+
+	//Nodes with all six neighbors stored, the border of the grid and of the stored bricks stays as it is
+	std::vector<char> solved(total, 0);
+
+	pool.ParallelFor(slots, POISSON_BRICK_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin * POISSON_BRICK_NODES; i < end * POISSON_BRICK_NODES; ++i)
+		{
+			int node[3];
+			level.Coordinates(i, node);
+
+			bool inner = true;
+			for (int axis = 0; axis < 3 && inner; ++axis)
+			{
+				inner = node[axis] > 0 && node[axis] < level.cells &&
+					level.Step(i, axis, -1) != Level::None && level.Step(i, axis, 1) != Level::None;
+			}
+
+			solved[i] = inner;
+		}
+	});
+
+	std::vector<float> r(total, 0);
+
+	//out = A in over the solved nodes, returns in . out
+	auto apply = [&](const std::vector<float>& in, std::vector<float>& out)
+	{
+		return SlotSum(slots, pool, [&](std::size_t slot)
+		{
+			double sum = 0;
+
+			for (std::size_t i = slot * POISSON_BRICK_NODES; i < (slot + 1) * POISSON_BRICK_NODES; ++i)
+			{
+				if (!solved[i])
+					continue;
+
+				float neighbors = 0;
+				for (int axis = 0; axis < 3; ++axis)
+					neighbors += in[level.Step(i, axis, -1)] + in[level.Step(i, axis, 1)];
+
+				out[i] = (6 + screening * weight[i]) * in[i] - neighbors;
+				sum += static_cast<double>(in[i]) * out[i];
+			}
+			return sum;
+		});
+	};
+
+	//Right hand side, minus the central difference divergence of the normal field plus the screening target
+	//The residual of the upsampled start is b - A x, r holds A x for now
+	apply(x, r);
+
+	const double b2 = SlotSum(slots, pool, [&](std::size_t slot)
+	{
+		double sum = 0;
+
+		for (std::size_t i = slot * POISSON_BRICK_NODES; i < (slot + 1) * POISSON_BRICK_NODES; ++i)
+		{
+			if (!solved[i])
+				continue;
+
+			float divergence = 0;
+			for (int axis = 0; axis < 3; ++axis)
+				divergence += field[axis][level.Step(i, axis, 1)] - field[axis][level.Step(i, axis, -1)];
+
+			const float b = -0.5f * divergence + screening * weight[i] * POISSON_SCREENING_TARGET;
+			r[i] = b - r[i];
+			sum += static_cast<double>(b) * b;
+		}
+		return sum;
+	});
+
+	//Only the residual needs the normal field
+	for (int axis = 0; axis < 3; ++axis)
+		field[axis] = std::vector<float>();
+
+	if (b2 == 0)
+		return !pool.Cancelled();
+
+	std::vector<float> p(r);
+	std::vector<float> ap(total, 0);
+
+	double rr = SlotSum(slots, pool, [&](std::size_t slot)
+	{
+		double sum = 0;
+		for (std::size_t i = slot * POISSON_BRICK_NODES; i < (slot + 1) * POISSON_BRICK_NODES; ++i)
+			sum += static_cast<double>(r[i]) * r[i];
+		return sum;
+	});
+
+	for (int iteration = 0; iteration < maxIterations && rr > tolerance * tolerance * b2; ++iteration)
+	{
+		if (pool.Cancelled())
+			return false;
+
+		const double pAp = apply(p, ap);
+		if (pAp <= 0)
+			break;
+
+		const float alpha = static_cast<float>(rr / pAp);
+
+		const double rrNext = SlotSum(slots, pool, [&](std::size_t slot)
+		{
+			double sum = 0;
+
+			for (std::size_t i = slot * POISSON_BRICK_NODES; i < (slot + 1) * POISSON_BRICK_NODES; ++i)
+			{
+				x[i] += alpha * p[i];
+				r[i] -= alpha * ap[i];
+				sum += static_cast<double>(r[i]) * r[i];
+			}
+			return sum;
+		});
+
+		const float beta = static_cast<float>(rrNext / rr);
+		rr = rrNext;
+
+		pool.ParallelFor(slots, POISSON_BRICK_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t i = begin * POISSON_BRICK_NODES; i < end * POISSON_BRICK_NODES; ++i)
+				p[i] = r[i] + beta * p[i];
+		});
+	}
+
+	return !pool.Cancelled();
+}
+
+float PoissonSolver::Evaluate(std::size_t level, const double* grid) const
+{
+	const Level& current = levels[level];
+
+	int base[3];
+	float fraction[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		base[axis] = std::clamp(static_cast<int>(grid[axis]), 0, current.cells - 1);
+		fraction[axis] = static_cast<float>(grid[axis] - base[axis]);
+	}
+
+	float value = 0;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const int dx = corner & 1;
+		const int dy = (corner >> 1) & 1;
+		const int dz = corner >> 2;
+
+		const std::size_t index = current.Node(base[0] + dx, base[1] + dy, base[2] + dz);
+
+		//Outside the stored bricks the coarser level holds the function
+		if (index == Level::None)
+		{
+			if (level == 0)
+				return 0;
+
+			const double coarse[3] = { grid[0] / 2, grid[1] / 2, grid[2] / 2 };
+			return Evaluate(level - 1, coarse);
+		}
+
+		value += current.x[index] *
+			(dx ? fraction[0] : 1 - fraction[0]) *
+			(dy ? fraction[1] : 1 - fraction[1]) *
+			(dz ? fraction[2] : 1 - fraction[2]);
+	}
+
+	return value;
+}
+
+void PoissonSolver::Prolongate(std::size_t level, ThreadPool& pool)
+{
+	Level& fine = levels[level];
+
+	//Even fine nodes sit on coarse nodes, odd ones halfway between two
+	pool.ParallelFor(fine.SlotCount(), POISSON_BRICK_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin * POISSON_BRICK_NODES; i < end * POISSON_BRICK_NODES; ++i)
+		{
+			int node[3];
+			fine.Coordinates(i, node);
+
+			if (node[0] > fine.cells || node[1] > fine.cells || node[2] > fine.cells)
+				continue;
+
+			const double coarse[3] = { node[0] / 2.0, node[1] / 2.0, node[2] / 2.0 };
+			fine.x[i] = Evaluate(level - 1, coarse);
+		}
+	});
+}
+
+bool PoissonSolver::Solve(const std::vector<PointWithData>& points, float averageSpacing, ThreadPool& pool,
+	const std::function<void(float)>& progress)
+{
+	Clear();
+
+	if (points.empty())
+		return false;
+
+	//Bounding cube of the points plus padding
+	double minValue[3] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+	double maxValue[3] = { std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+
+	for (const auto& point : points)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			minValue[axis] = std::min(minValue[axis], std::get<0>(point)[axis]);
+			maxValue[axis] = std::max(maxValue[axis], std::get<0>(point)[axis]);
+		}
+	}
+
+	//Stray points outside the domain would only stretch the grid over empty space
+	if (bounded)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			minValue[axis] = std::max(minValue[axis], boundMin[axis]);
+			maxValue[axis] = std::min(maxValue[axis], boundMax[axis]);
+
+			if (minValue[axis] > maxValue[axis])
+				return false;
+		}
+	}
+
+	size = std::max(std::max(maxValue[0] - minValue[0], maxValue[1] - minValue[1]), maxValue[2] - minValue[2]);
+	size = std::max(size, 1e-3) * (1 + 2 * padding);
+
+	origin = Point(
+		(minValue[0] + maxValue[0] - size) / 2,
+		(minValue[1] + maxValue[1] - size) / 2,
+		(minValue[2] + maxValue[2] - size) / 2);
+
+	const int finest = std::clamp(depth, 1, POISSON_MAX_DEPTH);
+	const int coarsest = std::min(finest, POISSON_COARSEST_DEPTH);
+
+	//Dense levels cost about 8 times the one before, the sparse ones about 4 times
+	double work = 0;
+	for (int l = coarsest; l <= finest; ++l)
+		work += std::pow(l <= POISSON_DENSE_DEPTH ? 8.0 : 4.0, l);
+
+	double done = 0;
+
+	for (int l = coarsest; l <= finest; ++l)
+	{
+		levels.emplace_back();
+		Level& level = levels.back();
+		level.cells = 1 << l;
+		level.cellSize = size / level.cells;
+		level.bricks = level.cells / POISSON_BRICK + 1;
+
+		Activate(points, l <= POISSON_DENSE_DEPTH, level);
+
+		std::vector<float> field[3];
+		std::vector<float> weight;
+		Splat(points, averageSpacing, level, field, weight, pool);
+
+		if (l > coarsest)
+			Prolongate(levels.size() - 1, pool);
+
+		const bool coarse = l == coarsest;
+		if (!SolveLevel(level, field, weight, coarse ? POISSON_COARSEST_ITERATIONS : std::max(iterations, 1),
+			coarse ? POISSON_COARSEST_TOLERANCE : POISSON_TOLERANCE, pool))
+			return false;
+
+		done += std::pow(l <= POISSON_DENSE_DEPTH ? 8.0 : 4.0, l);
+		progress(static_cast<float>(done / work));
+	}
+
+	//The surface passes through the average value at the points
+	const std::size_t chunks = ThreadPool::ChunkCount(points.size(), PARALLEL_GRAIN);
+	std::vector<double> chunkSum(chunks, 0);
+	std::vector<std::size_t> chunkCount(chunks, 0);
+
+	pool.ParallelFor(points.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			double grid[3];
+			if (InDomain(std::get<0>(points[i])) && GridPosition(levels.back(), std::get<0>(points[i]), grid))
+			{
+				chunkSum[begin / PARALLEL_GRAIN] += Evaluate(levels.size() - 1, grid);
+				++chunkCount[begin / PARALLEL_GRAIN];
+			}
+		}
+	});
+
+	if (pool.Cancelled())
+		return false;
+
+	double sum = 0;
+	std::size_t count = 0;
+	for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		sum += chunkSum[chunk];
+		count += chunkCount[chunk];
+	}
+
+	const float iso = count > 0 ? static_cast<float>(sum / count) : 0.0f;
+
+	//Every level is shifted, the finer ones read the coarser ones where they do not store nodes
+	for (Level& level : levels)
+	{
+		pool.ParallelFor(level.x.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t i = begin; i < end; ++i)
+				level.x[i] -= iso;
+		});
+	}
+
+	//The border is held at 0 before the iso value is taken off
+	outsideValue = -iso;
+
+	return !pool.Cancelled();
+}
+
+FT PoissonSolver::operator()(const Point& position) const
+{
+	double grid[3];
+	if (levels.empty() || !InDomain(position) || !GridPosition(levels.back(), position, grid))
+		return outsideValue;
+
+	return Evaluate(levels.size() - 1, grid);
+}
+
+Point PoissonSolver::GetInnerPoint() const
+{
+	if (levels.empty())
+		return origin;
+
+	//The deepest level storing every brick covers the whole inside
+	std::size_t dense = 0;
+	while (dense + 1 < levels.size() && levels[dense + 1].cells <= (1 << POISSON_DENSE_DEPTH))
+		++dense;
+
+	const Level& level = levels[dense];
+	float lowest = std::numeric_limits<float>::max();
+	int inner[3] = { 0, 0, 0 };
+
+	for (std::size_t i = 0; i < level.x.size(); ++i)
+	{
+		int node[3];
+		level.Coordinates(i, node);
+
+		if (node[0] > level.cells || node[1] > level.cells || node[2] > level.cells || level.x[i] >= lowest)
+			continue;
+
+		lowest = level.x[i];
+		std::copy(node, node + 3, inner);
+	}
+
+	return Point(
+		origin.x() + inner[0] * level.cellSize,
+		origin.y() + inner[1] * level.cellSize,
+		origin.z() + inner[2] * level.cellSize);
+}
+
+Sphere PoissonSolver::GetBoundingSphere() const
+{
+	const Point inner = GetInnerPoint();
+
+	double low[3];
+	double high[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		low[axis] = origin[axis];
+		high[axis] = origin[axis] + size;
+
+		if (bounded)
+		{
+			low[axis] = std::max(low[axis], boundMin[axis]);
+			high[axis] = std::min(high[axis], boundMax[axis]);
+		}
+	}
+
+	//Furthest corner of the grid from the inner point
+	FT squaredRadius = 0;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const Point point(
+			(corner & 1) ? high[0] : low[0],
+			((corner >> 1) & 1) ? high[1] : low[1],
+			(corner >> 2) ? high[2] : low[2]);
+
+		squaredRadius = std::max(squaredRadius, CGAL::squared_distance(inner, point));
+	}
+
+	return Sphere(inner, squaredRadius);
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+//Deepest level the solver runs
+//Levels past the dense ones only store the bricks around the samples, so their memory grows with the surface, about 4 times per level
+//Depth 10 for an object filling most of the cube takes about 1.2 GB while solving, a dense grid would need 4 GB for the solution alone
+#define POISSON_MAX_DEPTH 10
+
+//Nodes per axis of a brick, the unit the levels are stored in
+#define POISSON_BRICK 4
+#define POISSON_BRICK_NODES (POISSON_BRICK * POISSON_BRICK * POISSON_BRICK)
+
+//Screened Poisson reconstruction (Kazhdan and Hoppe 2013) solved coarse to fine on nested grids over the cloud's bounding cube
+//The coarse levels store every brick of nodes, the fine levels only the bricks around the samples and a margin of one brick
+//The outermost nodes a fine level stores keep the value of the coarser level, so the fine levels only refine the band around the surface
+//The function is read from the finest level storing the nodes around a position and from the coarser levels everywhere else, like an octree
+//Every level starts from the upsampled coarser solution and runs conjugate gradients until its residual is small
+//Values are negative inside, 0 on the surface and positive outside, like CGAL::Poisson_reconstruction_function
+class PoissonSolver
+{
+	//One level of the hierarchy, cells = 2^depth per axis
+	struct Level
+	{
+		int cells = 0;
+		double cellSize = 0;
+
+		//Bricks per axis and the slot every stored brick has in x, -1 = not stored
+		int bricks = 0;
+		std::vector<std::int32_t> slotOf;
+
+		//Brick coordinates of every slot and the slots of its face neighbors, -x +x -y +y -z +z
+		std::vector<std::array<int, 3>> brickOf;
+		std::vector<std::array<std::int32_t, 6>> neighbors;
+
+		//Solution, POISSON_BRICK_NODES per slot, x fastest then y then z inside a brick
+		std::vector<float> x;
+
+		static const std::size_t None = ~static_cast<std::size_t>(0);
+
+		std::size_t SlotCount() const { return brickOf.size(); }
+
+		//Index of a node in x, None if the node is outside the grid or its brick is not stored
+		std::size_t Node(int nx, int ny, int nz) const
+		{
+			if (nx < 0 || ny < 0 || nz < 0 || nx > cells || ny > cells || nz > cells)
+				return None;
+
+			const std::int32_t slot = slotOf[(static_cast<std::size_t>(nz / POISSON_BRICK) * bricks + ny / POISSON_BRICK) * bricks + nx / POISSON_BRICK];
+			if (slot < 0)
+				return None;
+
+			return static_cast<std::size_t>(slot) * POISSON_BRICK_NODES +
+				((nz % POISSON_BRICK) * POISSON_BRICK + ny % POISSON_BRICK) * POISSON_BRICK + nx % POISSON_BRICK;
+		}
+
+		//Grid coordinates of a node index
+		void Coordinates(std::size_t node, int* out) const
+		{
+			const std::array<int, 3>& brick = brickOf[node / POISSON_BRICK_NODES];
+			const int local = static_cast<int>(node % POISSON_BRICK_NODES);
+
+			out[0] = brick[0] * POISSON_BRICK + local % POISSON_BRICK;
+			out[1] = brick[1] * POISSON_BRICK + (local / POISSON_BRICK) % POISSON_BRICK;
+			out[2] = brick[2] * POISSON_BRICK + local / (POISSON_BRICK * POISSON_BRICK);
+		}
+
+		//Index of the node one step along axis (direction -1 or 1) from a node, None if its brick is not stored
+		std::size_t Step(std::size_t node, int axis, int direction) const
+		{
+			static const int stride[3] = { 1, POISSON_BRICK, POISSON_BRICK * POISSON_BRICK };
+
+			const std::size_t slot = node / POISSON_BRICK_NODES;
+			const int local = static_cast<int>(node % POISSON_BRICK_NODES);
+			const int coordinate = (local / stride[axis]) % POISSON_BRICK;
+			const int moved = coordinate + direction;
+
+			if (moved >= 0 && moved < POISSON_BRICK)
+				return node + direction * stride[axis];
+
+			const std::int32_t next = neighbors[slot][axis * 2 + (direction > 0)];
+			if (next < 0)
+				return None;
+
+			return static_cast<std::size_t>(next) * POISSON_BRICK_NODES + local - direction * (POISSON_BRICK - 1) * stride[axis];
+		}
+	};
+
+	//Coarsest first
+	std::vector<Level> levels;
+
+	Point origin;
+	double size = 0;
+
+	//Value returned outside the grid
+	float outsideValue = 1;
+
+	//Grid coordinates of a position on a level, false outside the grid
+	bool GridPosition(const Level& level, const Point& position, double* grid) const;
+
+	//Stores the bricks the samples splat onto and a margin of one brick around them, or every brick when dense
+	void Activate(const std::vector<PointWithData>& points, bool dense, Level& level) const;
+
+	//Trilinear splat of every point's normal and area onto the level's nodes
+	void Splat(const std::vector<PointWithData>& points, float averageSpacing, const Level& level,
+		std::vector<float>* field, std::vector<float>& weight, ThreadPool& pool) const;
+
+	//Conjugate gradients on (screening * weight - laplacian) x = screening * weight * target - divergence
+	//Only nodes with all six neighbors stored inside the grid are solved, the others keep their value
+	//Stops once the residual drops below tolerance w.r.t. the right hand side, returns false when cancelled
+	bool SolveLevel(Level& level, std::vector<float>* field, const std::vector<float>& weight,
+		int maxIterations, double tolerance, ThreadPool& pool) const;
+
+	//Value of a level at grid coordinates, read from the coarser levels where the level does not store the nodes
+	float Evaluate(std::size_t level, const double* grid) const;
+
+	//Upsamples the coarser level onto every node the level stores
+	void Prolongate(std::size_t level, ThreadPool& pool);
+
+	//Sum of func(slot) over the slots of a level, added up in chunk order so it does not depend on the threads
+	static double SlotSum(std::size_t slots, ThreadPool& pool, const std::function<double(std::size_t)>& func);
+
+	//Inside the domain box, always true when not bounded
+	bool InDomain(const Point& position) const;
+
+public:
+
+	//The finest level has 2^depth cells per axis, clamped to POISSON_MAX_DEPTH
+	int depth = 7;
+
+	//Weight of the screening term pulling the function to the middle of its step at the points, 0 = plain Poisson
+	float screening = 4;
+
+	//Most conjugate gradient iterations per level, a level stops earlier once it converged
+	//The coarsest level runs until it converges
+	int iterations = 100;
+
+	//Extra space around the points on every side w.r.t. the bounding cube's size
+	float padding = 0.1f;
+
+	//Limits the solve to a box, e.g. the scan's clip box: points outside it are ignored and the function is outside there
+	bool bounded = false;
+	Point boundMin;
+	Point boundMax;
+
+	//Solves the implicit function for oriented points, progress gets the fraction done
+	//Returns false if there are no points or the pool was cancelled
+	bool Solve(const std::vector<PointWithData>& points, float averageSpacing, ThreadPool& pool,
+		const std::function<void(float)>& progress);
+
+	//Trilinear value of the solved function
+	FT operator()(const Point& position) const;
+
+	//Deepest point inside the surface
+	Point GetInnerPoint() const;
+
+	//Sphere around the inner point holding the whole grid, or the part of it inside the domain
+	Sphere GetBoundingSphere() const;
+
+	//Nodes stored over all levels, what the solution takes in memory is 4 bytes each
+	std::size_t GetNodeCount() const;
+
+	void Clear();
+};
@@ -0,0 +1,51 @@
+#include "ShotPool.h"
+
+PointModel ShotPool::Acquire(std::size_t capacity)
+{
+	PointModel shot;
+
+	if (!pool.empty())
+	{
+		shot = std::move(pool.back());
+		pool.pop_back();
+	}
+
+	if (shot.points.capacity() < capacity)
+	{
+		shot.points.reserve(capacity);
+		++allocations;
+	}
+	else
+		++reuses;
+
+	return shot;
+}
+
+void ShotPool::Release(PointModel&& shot)
+{
+	//The depth grid is overwritten by the next capture, so it keeps its buffer too
+	shot.points.clear();
+	shot.viewpoints.clear();
+	shot.shotGrids.reset();
+	shot.frames.reset();
+
+	//Make sure the pool itself does not grow every frame
+	if (pool.capacity() == pool.size())
+		pool.reserve(pool.size() * 2 + 8);
+
+	pool.push_back(std::move(shot));
+}
+
+void ShotPool::ReleaseAll(std::vector<PointModel>& shots)
+{
+	for (auto& shot : shots)
+		Release(std::move(shot));
+
+	shots.clear();
+}
+
+void ShotPool::Trim()
+{
+	pool.clear();
+	pool.shrink_to_fit();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ModelData.h"
+
+#include <cstddef>
+#include <vector>
+
+//Recycles the point buffers of camera shots
+//The preview grabs a new shot every camera frame, released buffers keep their capacity for the next one
+class ShotPool
+{
+	std::vector<PointModel> pool;
+
+	//Buffers created or grown, only these touch the heap
+	std::size_t allocations = 0;
+
+	//Buffers handed out with enough capacity already
+	std::size_t reuses = 0;
+
+public:
+
+	//Empty shot able to hold capacity points without reallocating
+	PointModel Acquire(std::size_t capacity);
+
+	//Gives a shot's buffer back, its points are dropped
+	void Release(PointModel&& shot);
+
+	//Gives every shot back and empties shots, which keeps its own capacity
+	void ReleaseAll(std::vector<PointModel>& shots);
+
+	//Frees the pooled buffers
+	void Trim();
+
+	std::size_t GetAllocations() const { return allocations; }
+	std::size_t GetReuses() const { return reuses; }
+	std::size_t GetPooledCount() const { return pool.size(); }
+};
@@ -0,0 +1,105 @@
+#include "StageCache.h"
+
+#include <algorithm>
+
+void StageCache::Evict(std::size_t extraBytes)
+{
+	while (!entries.empty() && usedBytes + extraBytes > budgetBytes)
+	{
+		auto oldest = std::min_element(entries.begin(), entries.end(),
+			[](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+
+		usedBytes -= oldest->bytes;
+		entries.erase(oldest);
+	}
+}
+
+bool StageCache::Find(std::uint64_t key, PointModel& points, float& averageSpacing)
+{
+	for (auto& entry : entries)
+	{
+		if (entry.key == key)
+		{
+			points.points = *entry.points;
+			averageSpacing = entry.averageSpacing;
+			entry.lastUse = ++useCounter;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void StageCache::Store(std::uint64_t key, std::shared_ptr<const std::vector<PointWithData>> points, float averageSpacing)
+{
+	const std::size_t bytes = points->size() * sizeof(PointWithData);
+
+	if (bytes > budgetBytes || Contains(key))
+		return;
+
+	Evict(bytes);
+
+	entries.push_back({ key, std::move(points), averageSpacing, bytes, ++useCounter });
+	usedBytes += bytes;
+}
+
+bool StageCache::Contains(std::uint64_t key) const
+{
+	return std::any_of(entries.begin(), entries.end(), [key](const Entry& entry) { return entry.key == key; });
+}
+
+void StageCache::SetBudget(std::size_t bytes)
+{
+	budgetBytes = bytes;
+	Evict(0);
+}
+
+void StageCache::Clear()
+{
+	entries.clear();
+	usedBytes = 0;
+}
+
+std::uint64_t StageCache::Hash(const void* data, std::size_t bytes, std::uint64_t seed)
+{
+	const unsigned char* byte = static_cast<const unsigned char*>(data);
+
+	for (std::size_t i = 0; i < bytes; ++i)
+	{
+		seed ^= byte[i];
+		seed *= 1099511628211ull;
+	}
+
+	return seed;
+}
+
+std::uint64_t StageCache::HashPoints(const std::vector<PointWithData>& points, ThreadPool& pool)
+{
+	std::vector<std::uint64_t> chunkHash(ThreadPool::ChunkCount(points.size(), PARALLEL_GRAIN));
+
+	pool.ParallelFor(points.size(), PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end)
+	{
+		std::uint64_t hash = Hash(nullptr, 0);
+
+		//Field by field, the tuple has padding bytes
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const Point& point = std::get<0>(points[i]);
+			const Color& color = std::get<1>(points[i]);
+			const Vector& normal = std::get<2>(points[i]);
+
+			const double values[6] = { point.x(), point.y(), point.z(), normal.x(), normal.y(), normal.z() };
+			hash = Hash(values, sizeof(values), hash);
+			hash = Hash(color.data(), color.size(), hash);
+			hash = Hash(&std::get<3>(points[i]), sizeof(int), hash);
+		}
+
+		chunkHash[begin / PARALLEL_GRAIN] = hash;
+	});
+
+	std::uint64_t hash = HashValue(Hash(nullptr, 0), points.size());
+	for (std::uint64_t chunk : chunkHash)
+		hash = HashValue(hash, chunk);
+
+	return hash;
+}
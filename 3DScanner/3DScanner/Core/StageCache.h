@@ -0,0 +1,68 @@
+#pragma once
+
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//Snapshots of the point processing stage outputs
+//Keyed by a hash of the input cloud and every setting up to that stage, so only stages after a changed setting are run again
+class StageCache
+{
+	struct Entry
+	{
+		std::uint64_t key;
+		std::shared_ptr<const std::vector<PointWithData>> points;
+		float averageSpacing;
+		std::size_t bytes;
+		std::uint64_t lastUse;
+	};
+
+	std::vector<Entry> entries;
+
+	std::size_t budgetBytes;
+	std::size_t usedBytes = 0;
+	std::uint64_t useCounter = 0;
+
+	//Drops the least recently used snapshots until extraBytes fits in the budget
+	void Evict(std::size_t extraBytes);
+
+public:
+
+	explicit StageCache(std::size_t budgetBytes = 1024u * 1024u * 1024u) : budgetBytes(budgetBytes) {}
+
+	//Copies the snapshot for key into points, returns false if it is not cached
+	bool Find(std::uint64_t key, PointModel& points, float& averageSpacing);
+
+	//Keeps points, which must not change afterwards, skipped if they alone are bigger than the budget
+	void Store(std::uint64_t key, std::shared_ptr<const std::vector<PointWithData>> points, float averageSpacing);
+
+	bool Contains(std::uint64_t key) const;
+
+	void SetBudget(std::size_t bytes);
+
+	std::size_t GetUsedBytes() const { return usedBytes; }
+
+	std::size_t GetEntryCount() const { return entries.size(); }
+
+	void Clear();
+
+	//FNV-1a over raw bytes, continued from seed
+	static std::uint64_t Hash(const void* data, std::size_t bytes, std::uint64_t seed = 14695981039346656037ull);
+
+	template<typename T>
+	static std::uint64_t HashValue(std::uint64_t seed, const T& value) { return Hash(&value, sizeof(T), seed); }
+
+	template<typename... T>
+	static std::uint64_t HashValues(const T&... values)
+	{
+		std::uint64_t seed = Hash(nullptr, 0);
+		((seed = HashValue(seed, values)), ...);
+		return seed;
+	}
+
+	//Hash of every position, color and normal, computed per chunk so it does not depend on the thread count
+	static std::uint64_t HashPoints(const std::vector<PointWithData>& points, ThreadPool& pool);
+};
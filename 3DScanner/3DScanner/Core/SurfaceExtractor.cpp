@@ -0,0 +1,332 @@
+#include "SurfaceExtractor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//Biggest sampled grid per axis, the cell grows to stay under it
+#define SURFACE_MAX_NODES 512
+
+void SurfaceExtractor::Clear()
+{
+	values.clear();
+	values.shrink_to_fit();
+	nodes[0] = nodes[1] = nodes[2] = 0;
+	keys.reset();
+	slots.clear();
+	slots.shrink_to_fit();
+	tableMask = 0;
+}
+
+bool SurfaceExtractor::Sample(const std::function<FT(const Point&)>& function, bool threadSafe,
+	const Point& boxMin, const Point& boxMax, double cell, ThreadPool& pool,
+	const std::function<void(float)>& progress)
+{
+	Clear();
+
+	double extent[3];
+	for (int axis = 0; axis < 3; ++axis)
+		extent[axis] = std::max(boxMax[axis] - boxMin[axis], 0.0);
+
+	const double biggest = std::max(extent[0], std::max(extent[1], extent[2]));
+	if (biggest <= 0 || cell <= 0)
+		return false;
+
+	cellSize = std::max(cell, biggest / (SURFACE_MAX_NODES - 1));
+	origin = boxMin;
+
+	for (int axis = 0; axis < 3; ++axis)
+		nodes[axis] = std::max(2, static_cast<int>(std::ceil(extent[axis] / cellSize)) + 1);
+
+	values.resize(static_cast<std::size_t>(nodes[0]) * nodes[1] * nodes[2]);
+
+	std::atomic<int> slicesDone{ 0 };
+
+	auto sampleSlice = [&](int z)
+	{
+		for (int y = 0; y < nodes[1]; ++y)
+		{
+			for (int x = 0; x < nodes[0]; ++x)
+			{
+				const Point position(origin.x() + x * cellSize, origin.y() + y * cellSize, origin.z() + z * cellSize);
+				values[Index(x, y, z)] = static_cast<float>(function(position));
+			}
+		}
+
+		progress(static_cast<float>(++slicesDone) / nodes[2]);
+	};
+
+	if (threadSafe)
+	{
+		pool.ParallelFor(nodes[2], 1, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t z = begin; z < end; ++z)
+				sampleSlice(static_cast<int>(z));
+		});
+	}
+	else
+	{
+		for (int z = 0; z < nodes[2] && !pool.Cancelled(); ++z)
+			sampleSlice(z);
+	}
+
+	return !pool.Cancelled();
+}
+
+void SurfaceExtractor::Downsample(const SurfaceExtractor& fine, int factor, ThreadPool& pool)
+{
+	Clear();
+
+	factor = std::max(factor, 1);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		//Too coarse to hold a single cell
+		if (fine.nodes[axis] < 2 * factor)
+		{
+			Clear();
+			return;
+		}
+
+		nodes[axis] = (fine.nodes[axis] - 1) / factor + 1;
+	}
+
+	origin = fine.origin;
+	cellSize = fine.cellSize * factor;
+	values.resize(static_cast<std::size_t>(nodes[0]) * nodes[1] * nodes[2]);
+
+	pool.ParallelFor(nodes[2], 1, [&](std::size_t begin, std::size_t end)
+	{
+		for (int z = static_cast<int>(begin); z < static_cast<int>(end); ++z)
+		{
+			for (int y = 0; y < nodes[1]; ++y)
+			{
+				for (int x = 0; x < nodes[0]; ++x)
+					values[Index(x, y, z)] = fine.values[fine.Index(x * factor, y * factor, z * factor)];
+			}
+		}
+	});
+}
+
+int SurfaceExtractor::CellMask(int x, int y, int z) const
+{
+	int mask = 0;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		if (values[Index(x + (corner & 1), y + ((corner >> 1) & 1), z + (corner >> 2))] < 0)
+			mask |= 1 << corner;
+	}
+
+	return mask;
+}
+
+void SurfaceExtractor::Insert(std::uint64_t cell, std::uint32_t vertex)
+{
+	const std::uint64_t key = cell + 1;
+	std::uint64_t slot = (key * 0x9E3779B97F4A7C15ull) & tableMask;
+
+	while (true)
+	{
+		std::uint64_t expected = 0;
+		if (keys[slot].compare_exchange_strong(expected, key, std::memory_order_relaxed))
+		{
+			slots[slot] = vertex;
+			return;
+		}
+
+		slot = (slot + 1) & tableMask;
+	}
+}
+
+std::uint32_t SurfaceExtractor::Find(std::uint64_t cell) const
+{
+	const std::uint64_t key = cell + 1;
+	std::uint64_t slot = (key * 0x9E3779B97F4A7C15ull) & tableMask;
+
+	while (true)
+	{
+		const std::uint64_t found = keys[slot].load(std::memory_order_relaxed);
+
+		if (found == key)
+			return slots[slot];
+		if (found == 0)
+			return std::numeric_limits<std::uint32_t>::max();
+
+		slot = (slot + 1) & tableMask;
+	}
+}
+
+void SurfaceExtractor::CellVertex(int x, int y, int z, float* out) const
+{
+	double sum[3] = { 0, 0, 0 };
+	int crossings = 0;
+
+	//The twelve edges join corners that differ in one axis
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const int from[3] = { corner & 1, (corner >> 1) & 1, corner >> 2 };
+		const float a = values[Index(x + from[0], y + from[1], z + from[2])];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (from[axis])
+				continue;
+
+			int to[3] = { from[0], from[1], from[2] };
+			to[axis] = 1;
+
+			const float b = values[Index(x + to[0], y + to[1], z + to[2])];
+			if ((a < 0) == (b < 0))
+				continue;
+
+			const double t = a / static_cast<double>(a - b);
+			for (int i = 0; i < 3; ++i)
+				sum[i] += from[i] + (i == axis ? t : 0);
+			++crossings;
+		}
+	}
+
+	const int cell[3] = { x, y, z };
+	for (int axis = 0; axis < 3; ++axis)
+		out[axis] = static_cast<float>(origin[axis] + (cell[axis] + sum[axis] / crossings) * cellSize);
+}
+
+bool SurfaceExtractor::Extract(IndexedMesh& mesh, ThreadPool& pool)
+{
+	mesh.Clear();
+
+	if (values.empty())
+		return false;
+
+	const int cells[3] = { nodes[0] - 1, nodes[1] - 1, nodes[2] - 1 };
+	auto cellIndex = [&](int x, int y, int z) { return (static_cast<std::uint64_t>(z) * cells[1] + y) * cells[0] + x; };
+	auto crossed = [](int mask) { return mask != 0 && mask != 0xff; };
+
+	//Crossed cells per slab, their prefix sums number the vertices in slab order
+	std::vector<std::uint32_t> slabStart(cells[2] + 1, 0);
+
+	pool.ParallelFor(cells[2], 1, [&](std::size_t begin, std::size_t end)
+	{
+		for (int z = static_cast<int>(begin); z < static_cast<int>(end); ++z)
+		{
+			std::uint32_t count = 0;
+			for (int y = 0; y < cells[1]; ++y)
+			{
+				for (int x = 0; x < cells[0]; ++x)
+					count += crossed(CellMask(x, y, z));
+			}
+
+			slabStart[z + 1] = count;
+		}
+	});
+
+	if (pool.Cancelled())
+		return false;
+
+	for (int z = 0; z < cells[2]; ++z)
+		slabStart[z + 1] += slabStart[z];
+
+	const std::size_t vertexCount = slabStart[cells[2]];
+	if (vertexCount == 0)
+		return false;
+
+	std::size_t tableSize = 1;
+	while (tableSize < vertexCount * 2)
+		tableSize <<= 1;
+
+	keys = std::make_unique<std::atomic<std::uint64_t>[]>(tableSize);
+	slots.assign(tableSize, 0);
+	tableMask = tableSize - 1;
+
+	mesh.vertices.resize(vertexCount * 3);
+
+	pool.ParallelFor(cells[2], 1, [&](std::size_t begin, std::size_t end)
+	{
+		for (int z = static_cast<int>(begin); z < static_cast<int>(end); ++z)
+		{
+			std::uint32_t vertex = slabStart[z];
+
+			for (int y = 0; y < cells[1]; ++y)
+			{
+				for (int x = 0; x < cells[0]; ++x)
+				{
+					if (!crossed(CellMask(x, y, z)))
+						continue;
+
+					CellVertex(x, y, z, &mesh.vertices[static_cast<std::size_t>(vertex) * 3]);
+					Insert(cellIndex(x, y, z), vertex++);
+				}
+			}
+		}
+	});
+
+	if (pool.Cancelled())
+		return false;
+
+	//A crossed edge joins the vertices of the four cells around it, per node slice and merged in slice order
+	std::vector<std::vector<std::uint32_t>> sliceTriangles(nodes[2]);
+
+	pool.ParallelFor(nodes[2], 1, [&](std::size_t begin, std::size_t end)
+	{
+		for (int z = static_cast<int>(begin); z < static_cast<int>(end); ++z)
+		{
+			std::vector<std::uint32_t>& triangles = sliceTriangles[z];
+
+			for (int y = 0; y < nodes[1]; ++y)
+			{
+				for (int x = 0; x < nodes[0]; ++x)
+				{
+					const int node[3] = { x, y, z };
+					const bool inside = values[Index(x, y, z)] < 0;
+
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						//The other two axes in cyclic order, so the quad winds around +axis
+						const int u = (axis + 1) % 3;
+						const int v = (axis + 2) % 3;
+
+						if (node[axis] + 1 >= nodes[axis] || node[u] < 1 || node[u] + 1 >= nodes[u] || node[v] < 1 || node[v] + 1 >= nodes[v])
+							continue;
+
+						int next[3] = { x, y, z };
+						++next[axis];
+						if ((values[Index(next[0], next[1], next[2])] < 0) == inside)
+							continue;
+
+						std::uint32_t quad[4];
+						const int corners[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+						for (int c = 0; c < 4; ++c)
+						{
+							int cell[3] = { x, y, z };
+							cell[u] += corners[c][0] - 1;
+							cell[v] += corners[c][1] - 1;
+							quad[c] = Find(cellIndex(cell[0], cell[1], cell[2]));
+						}
+
+						//Faces point from inside to outside
+						if (!inside)
+							std::swap(quad[1], quad[3]);
+
+						triangles.insert(triangles.end(), { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] });
+					}
+				}
+			}
+		}
+	});
+
+	if (pool.Cancelled())
+		return false;
+
+	std::size_t total = 0;
+	for (const auto& triangles : sliceTriangles)
+		total += triangles.size();
+
+	mesh.triangles.reserve(total);
+	for (auto& triangles : sliceTriangles)
+	{
+		mesh.triangles.insert(mesh.triangles.end(), triangles.begin(), triangles.end());
+		triangles = std::vector<std::uint32_t>();
+	}
+
+	return true;
+}
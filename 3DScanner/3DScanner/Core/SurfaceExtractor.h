@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+//Extracts the zero level of an implicit function sampled on a regular grid, negative inside
+//Surface nets: one vertex per cell the surface crosses and a quad across every crossed grid edge
+//Cells are welded to their vertex through a lock-free hash table so the slabs of the grid can run at once
+//Ambiguous cells are not resolved: a cell crossed by two sheets gets a single vertex, so noisy input can give non-manifold edges and vertices
+class SurfaceExtractor
+{
+	//Nodes per axis of the sampled grid and the sampled values, x fastest then y then z
+	int nodes[3] = { 0, 0, 0 };
+	std::vector<float> values;
+
+	Point origin;
+	double cellSize = 0;
+
+	//Open addressing table from cell index + 1 to its vertex, 0 = empty slot
+	std::unique_ptr<std::atomic<std::uint64_t>[]> keys;
+	std::vector<std::uint32_t> slots;
+	std::uint64_t tableMask = 0;
+
+	std::size_t Index(int x, int y, int z) const { return (static_cast<std::size_t>(z) * nodes[1] + y) * nodes[0] + x; }
+
+	//Sign pattern of a cell's eight corners, bit set = inside
+	int CellMask(int x, int y, int z) const;
+
+	void Insert(std::uint64_t cell, std::uint32_t vertex);
+
+	std::uint32_t Find(std::uint64_t cell) const;
+
+	//Vertex of a crossed cell, the mean of the points where its edges cross the surface
+	void CellVertex(int x, int y, int z, float* out) const;
+
+public:
+
+	//Samples function at every grid node of the box, serially unless the function may be called from several threads
+	//Returns false if cancelled
+	bool Sample(const std::function<FT(const Point&)>& function, bool threadSafe,
+		const Point& boxMin, const Point& boxMax, double cell, ThreadPool& pool,
+		const std::function<void(float)>& progress);
+
+	//Takes every factor-th node of a finer sampling, a coarser level of the same function without sampling it again
+	void Downsample(const SurfaceExtractor& fine, int factor, ThreadPool& pool);
+
+	//Meshes the sampled grid, triangles face the positive side of the function
+	//The output only depends on the samples, never on the thread count
+	bool Extract(IndexedMesh& mesh, ThreadPool& pool);
+
+	int GetNodeCount(int axis) const { return nodes[axis]; }
+
+	void Clear();
+};
@@ -0,0 +1,509 @@
+#include "TextureBaker.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+//Attempts at shrinking the charts until they fit the atlas
+#define TEXTURE_PACK_ATTEMPTS 64
+
+//Color of texels no shot sees on a mesh without vertex colors
+#define TEXTURE_FALLBACK_GRAY 128
+
+void TextureBaker::BuildCharts(const IndexedMesh& mesh, std::vector<Chart>& charts) const
+{
+	const std::size_t faceCount = mesh.TriangleCount();
+
+	//Axis and sign of the biggest normal component, 6 directions
+	std::vector<std::uint8_t> labels(faceCount, 0);
+	for (std::size_t f = 0; f < faceCount; ++f)
+	{
+		const float* a = &mesh.vertices[mesh.triangles[f * 3] * 3];
+		const float* b = &mesh.vertices[mesh.triangles[f * 3 + 1] * 3];
+		const float* c = &mesh.vertices[mesh.triangles[f * 3 + 2] * 3];
+
+		const float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		const float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		const float n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+
+		int axis = 0;
+		for (int i = 1; i < 3; ++i)
+		{
+			if (std::abs(n[i]) > std::abs(n[axis]))
+				axis = i;
+		}
+
+		labels[f] = static_cast<std::uint8_t>(axis * 2 + (n[axis] < 0));
+	}
+
+	//Faces sharing an edge sort next to each other
+	std::vector<std::array<std::uint32_t, 3>> edges;
+	edges.reserve(faceCount * 3);
+	for (std::size_t f = 0; f < faceCount; ++f)
+	{
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			const std::uint32_t a = mesh.triangles[f * 3 + corner];
+			const std::uint32_t b = mesh.triangles[f * 3 + (corner + 1) % 3];
+			edges.push_back({ std::min(a, b), std::max(a, b), static_cast<std::uint32_t>(f) });
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	std::vector<std::uint32_t> parent(faceCount);
+	std::iota(parent.begin(), parent.end(), 0);
+
+	auto find = [&parent](std::uint32_t face)
+	{
+		while (parent[face] != face)
+		{
+			parent[face] = parent[parent[face]];
+			face = parent[face];
+		}
+		return face;
+	};
+
+	for (std::size_t i = 1; i < edges.size(); ++i)
+	{
+		const auto& previous = edges[i - 1];
+		const auto& current = edges[i];
+
+		if (previous[0] != current[0] || previous[1] != current[1] || labels[previous[2]] != labels[current[2]])
+			continue;
+
+		const std::uint32_t a = find(previous[2]);
+		const std::uint32_t b = find(current[2]);
+		if (a != b)
+			parent[std::max(a, b)] = std::min(a, b);
+	}
+
+	//Charts numbered by their first face
+	charts.clear();
+	std::vector<std::uint32_t> chartOf(faceCount, std::numeric_limits<std::uint32_t>::max());
+
+	for (std::size_t f = 0; f < faceCount; ++f)
+	{
+		const std::uint32_t root = find(static_cast<std::uint32_t>(f));
+		if (chartOf[root] == std::numeric_limits<std::uint32_t>::max())
+		{
+			chartOf[root] = static_cast<std::uint32_t>(charts.size());
+			charts.emplace_back();
+			charts.back().axis = labels[f] / 2;
+		}
+
+		charts[chartOf[root]].faces.push_back(static_cast<std::uint32_t>(f));
+	}
+
+	for (Chart& chart : charts)
+	{
+		const int u = (chart.axis + 1) % 3;
+		const int v = (chart.axis + 2) % 3;
+
+		chart.min[0] = chart.min[1] = std::numeric_limits<float>::max();
+		chart.max[0] = chart.max[1] = std::numeric_limits<float>::lowest();
+
+		for (std::uint32_t f : chart.faces)
+		{
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const float* vertex = &mesh.vertices[mesh.triangles[f * 3 + corner] * 3];
+				chart.min[0] = std::min(chart.min[0], vertex[u]);
+				chart.min[1] = std::min(chart.min[1], vertex[v]);
+				chart.max[0] = std::max(chart.max[0], vertex[u]);
+				chart.max[1] = std::max(chart.max[1], vertex[v]);
+			}
+		}
+	}
+}
+
+bool TextureBaker::Pack(std::vector<Chart>& charts, double scale, int size) const
+{
+	for (Chart& chart : charts)
+	{
+		chart.width = static_cast<int>(std::ceil((chart.max[0] - chart.min[0]) * scale)) + 1 + 2 * padding;
+		chart.height = static_cast<int>(std::ceil((chart.max[1] - chart.min[1]) * scale)) + 1 + 2 * padding;
+	}
+
+	//Tallest first, rows fill left to right
+	std::vector<std::size_t> order(charts.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&charts](std::size_t a, std::size_t b) { return charts[a].height > charts[b].height; });
+
+	int x = 0;
+	int y = 0;
+	int rowHeight = 0;
+
+	for (std::size_t index : order)
+	{
+		Chart& chart = charts[index];
+
+		if (chart.width > size)
+			return false;
+
+		if (x + chart.width > size)
+		{
+			x = 0;
+			y += rowHeight;
+			rowHeight = 0;
+		}
+
+		if (y + chart.height > size)
+			return false;
+
+		chart.x = x;
+		chart.y = y;
+		x += chart.width;
+		rowHeight = std::max(rowHeight, chart.height);
+	}
+
+	return true;
+}
+
+void TextureBaker::TexelPosition(const Chart& chart, const float* vertex, double scale, float* texel) const
+{
+	const int u = (chart.axis + 1) % 3;
+	const int v = (chart.axis + 2) % 3;
+
+	texel[0] = static_cast<float>(chart.x + padding + 0.5 + (vertex[u] - chart.min[0]) * scale);
+	texel[1] = static_cast<float>(chart.y + padding + 0.5 + (vertex[v] - chart.min[1]) * scale);
+}
+
+bool TextureBaker::SampleShots(const float* position, const float* normal, const std::vector<ShotPose>& poses,
+	FrameStore& frames, unsigned char* color) const
+{
+	const int frameWidth = frames.GetWidth();
+	const int frameHeight = frames.GetHeight();
+	const float tolerance = visibilityTolerance * 1000.0f;
+
+	const ShotGrid* best = nullptr;
+	float bestFacing = minFacing;
+	float bestU = 0;
+	float bestV = 0;
+
+	for (const ShotPose& pose : poses)
+	{
+		const ShotGrid& grid = *pose.grid;
+
+		//Same turn as PointModel::RotatePoint and RotateNormal, backwards
+		const glm::vec3 offset = glm::vec3(position[0], position[1], position[2]) - grid.center;
+		const glm::vec3 local(
+			offset.x * pose.cosine - offset.z * pose.sine + grid.center.x,
+			offset.y + grid.center.y,
+			offset.x * pose.sine + offset.z * pose.cosine + grid.center.z);
+		const glm::vec3 localNormal(
+			normal[0] * pose.cosine - normal[2] * pose.sine,
+			normal[1],
+			normal[0] * pose.sine + normal[2] * pose.cosine);
+
+		//The camera sits at the origin of its space
+		const float distance = glm::length(local);
+		if (distance <= 0)
+			continue;
+
+		const float facing = -glm::dot(localNormal, local) / distance;
+		if (facing <= bestFacing)
+			continue;
+
+		int x, y;
+		if (!grid.Project(local, x, y))
+			continue;
+
+		//Something in front of the point hides it from this shot
+		const std::uint16_t depth = grid.depth[x + y * grid.width];
+		if (depth == 0 || local.z * 1000.0f > depth + tolerance)
+			continue;
+
+		float u, v;
+		if (!grid.ProjectColor(local, u, v) || u < 0 || v < 0 || u > frameWidth - 1 || v > frameHeight - 1)
+			continue;
+
+		best = &grid;
+		bestFacing = facing;
+		bestU = u;
+		bestV = v;
+	}
+
+	if (!best)
+		return false;
+
+	const unsigned char* pixels = frames.Frame(best->frame);
+	if (!pixels)
+		return false;
+
+	//Bilinear between the four pixels around the projection
+	const int x0 = std::min(static_cast<int>(bestU), frameWidth - 2);
+	const int y0 = std::min(static_cast<int>(bestV), frameHeight - 2);
+	const float fx = bestU - x0;
+	const float fy = bestV - y0;
+
+	const unsigned char* p00 = pixels + (static_cast<std::size_t>(y0) * frameWidth + x0) * 3;
+	const unsigned char* p10 = p00 + 3;
+	const unsigned char* p01 = p00 + static_cast<std::size_t>(frameWidth) * 3;
+	const unsigned char* p11 = p01 + 3;
+
+	for (int channel = 0; channel < 3; ++channel)
+	{
+		const float top = p00[channel] + (p10[channel] - p00[channel]) * fx;
+		const float bottom = p01[channel] + (p11[channel] - p01[channel]) * fx;
+		color[channel] = static_cast<unsigned char>(std::min(255.0f, top + (bottom - top) * fy + 0.5f));
+	}
+
+	return true;
+}
+
+void TextureBaker::Dilate(TextureImage& texture, std::vector<char>& covered, ThreadPool& pool) const
+{
+	const int size = texture.width;
+
+	//Uncovered texels only read covered ones, which do not change during a pass
+	for (int pass = 0; pass <= padding; ++pass)
+	{
+		std::vector<char> next = covered;
+
+		pool.ParallelFor(size, 16, [&](std::size_t begin, std::size_t end)
+		{
+			for (int y = static_cast<int>(begin); y < static_cast<int>(end); ++y)
+			{
+				for (int x = 0; x < size; ++x)
+				{
+					const std::size_t index = static_cast<std::size_t>(y) * size + x;
+					if (covered[index])
+						continue;
+
+					int sum[3] = { 0, 0, 0 };
+					int count = 0;
+
+					for (int dy = -1; dy <= 1; ++dy)
+					{
+						for (int dx = -1; dx <= 1; ++dx)
+						{
+							const int nx = x + dx;
+							const int ny = y + dy;
+							if (nx < 0 || ny < 0 || nx >= size || ny >= size)
+								continue;
+
+							const std::size_t neighbor = static_cast<std::size_t>(ny) * size + nx;
+							if (!covered[neighbor])
+								continue;
+
+							for (int channel = 0; channel < 3; ++channel)
+								sum[channel] += texture.rgb[neighbor * 3 + channel];
+							++count;
+						}
+					}
+
+					if (count == 0)
+						continue;
+
+					for (int channel = 0; channel < 3; ++channel)
+						texture.rgb[index * 3 + channel] = static_cast<unsigned char>((sum[channel] + count / 2) / count);
+					next[index] = 1;
+				}
+			}
+		});
+
+		covered = std::move(next);
+	}
+}
+
+bool TextureBaker::Bake(IndexedMesh& mesh, const std::vector<ShotGrid>& grids, FrameStore& frames, ThreadPool& pool,
+	TextureImage& texture, const std::function<void(float)>& progress) const
+{
+	mesh.texcoords.clear();
+	mesh.texcoordIndices.clear();
+
+	if (mesh.TriangleCount() == 0 || textureSize <= 0)
+		return false;
+
+	std::vector<Chart> charts;
+	BuildCharts(mesh, charts);
+
+	//Start from the scale that fills most of the atlas and shrink until the charts fit
+	//Many small charts can fill the atlas with padding alone, then the atlas grows instead
+	double area = 0;
+	for (const Chart& chart : charts)
+		area += static_cast<double>(chart.max[0] - chart.min[0]) * (chart.max[1] - chart.min[1]);
+
+	int size = textureSize;
+	double scale = 1;
+	bool packed = false;
+
+	while (!packed)
+	{
+		scale = area > 0 ? std::sqrt(0.7 * size * size / area) : 1.0;
+
+		for (int attempt = 0; attempt < TEXTURE_PACK_ATTEMPTS && !packed; ++attempt)
+		{
+			packed = Pack(charts, scale, size);
+			if (!packed)
+				scale *= 0.92;
+		}
+
+		if (!packed)
+		{
+			if (size * 2 > maxTextureSize)
+				return false;
+
+			size *= 2;
+		}
+	}
+
+	//A vertex gets one texcoord per chart it is part of
+	std::vector<std::uint32_t> vertexTexcoord(mesh.VertexCount());
+	std::vector<std::uint32_t> vertexChart(mesh.VertexCount(), std::numeric_limits<std::uint32_t>::max());
+	mesh.texcoordIndices.resize(mesh.triangles.size());
+
+	for (std::uint32_t c = 0; c < charts.size(); ++c)
+	{
+		for (std::uint32_t f : charts[c].faces)
+		{
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const std::uint32_t vertex = mesh.triangles[f * 3 + corner];
+
+				if (vertexChart[vertex] != c)
+				{
+					float texel[2];
+					TexelPosition(charts[c], &mesh.vertices[vertex * 3], scale, texel);
+
+					vertexChart[vertex] = c;
+					vertexTexcoord[vertex] = static_cast<std::uint32_t>(mesh.texcoords.size() / 2);
+
+					//OBJ texture rows go up
+					mesh.texcoords.push_back(texel[0] / size);
+					mesh.texcoords.push_back(1.0f - texel[1] / size);
+				}
+
+				mesh.texcoordIndices[f * 3 + corner] = vertexTexcoord[vertex];
+			}
+		}
+	}
+
+	std::vector<ShotPose> poses;
+	for (const ShotGrid& grid : grids)
+	{
+		if (grid.frame < 0 || grid.depth.empty())
+			continue;
+
+		ShotPose pose;
+		pose.grid = &grid;
+		pose.sine = std::sin(-grid.turn);
+		pose.cosine = std::cos(-grid.turn);
+		poses.push_back(pose);
+	}
+
+	if (!poses.empty() && !frames.Map())
+		poses.clear();
+
+	texture.width = size;
+	texture.height = size;
+	texture.rgb.assign(static_cast<std::size_t>(size) * size * 3, 0);
+	std::vector<char> covered(static_cast<std::size_t>(size) * size, 0);
+
+	std::vector<float> normals;
+	mesh.VertexNormals(normals);
+
+	const bool colored = mesh.colors.size() == mesh.vertices.size();
+	std::atomic<std::size_t> chartsDone{ 0 };
+
+	//Charts never share a texel, so every chart is rasterized on its own
+	pool.ParallelFor(charts.size(), 1, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t c = begin; c < end; ++c)
+		{
+			const Chart& chart = charts[c];
+
+			for (std::uint32_t f : chart.faces)
+			{
+				const std::uint32_t* face = &mesh.triangles[f * 3];
+
+				float texel[3][2];
+				for (int corner = 0; corner < 3; ++corner)
+					TexelPosition(chart, &mesh.vertices[face[corner] * 3], scale, texel[corner]);
+
+				const float area2 = (texel[1][0] - texel[0][0]) * (texel[2][1] - texel[0][1]) - (texel[2][0] - texel[0][0]) * (texel[1][1] - texel[0][1]);
+				if (std::abs(area2) < 1e-12f)
+					continue;
+
+				const int minX = std::max(chart.x, static_cast<int>(std::floor(std::min({ texel[0][0], texel[1][0], texel[2][0] }))));
+				const int minY = std::max(chart.y, static_cast<int>(std::floor(std::min({ texel[0][1], texel[1][1], texel[2][1] }))));
+				const int maxX = std::min(chart.x + chart.width - 1, static_cast<int>(std::ceil(std::max({ texel[0][0], texel[1][0], texel[2][0] }))));
+				const int maxY = std::min(chart.y + chart.height - 1, static_cast<int>(std::ceil(std::max({ texel[0][1], texel[1][1], texel[2][1] }))));
+
+				for (int y = minY; y <= maxY; ++y)
+				{
+					for (int x = minX; x <= maxX; ++x)
+					{
+						//Barycentric coordinates of the texel center
+						const float px = x + 0.5f;
+						const float py = y + 0.5f;
+
+						float weight[3];
+						weight[0] = ((texel[1][0] - px) * (texel[2][1] - py) - (texel[2][0] - px) * (texel[1][1] - py)) / area2;
+						weight[1] = ((texel[2][0] - px) * (texel[0][1] - py) - (texel[0][0] - px) * (texel[2][1] - py)) / area2;
+						weight[2] = 1.0f - weight[0] - weight[1];
+
+						if (weight[0] < -1e-4f || weight[1] < -1e-4f || weight[2] < -1e-4f)
+							continue;
+
+						float position[3] = { 0, 0, 0 };
+						float normal[3] = { 0, 0, 0 };
+						for (int corner = 0; corner < 3; ++corner)
+						{
+							for (int axis = 0; axis < 3; ++axis)
+							{
+								position[axis] += weight[corner] * mesh.vertices[face[corner] * 3 + axis];
+								normal[axis] += weight[corner] * normals[face[corner] * 3 + axis];
+							}
+						}
+
+						const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+						if (length > 0)
+						{
+							for (int axis = 0; axis < 3; ++axis)
+								normal[axis] /= length;
+						}
+
+						const std::size_t index = static_cast<std::size_t>(y) * size + x;
+						unsigned char* color = &texture.rgb[index * 3];
+
+						if (!SampleShots(position, normal, poses, frames, color))
+						{
+							for (int channel = 0; channel < 3; ++channel)
+							{
+								float value = TEXTURE_FALLBACK_GRAY;
+								if (colored)
+								{
+									value = 0;
+									for (int corner = 0; corner < 3; ++corner)
+										value += weight[corner] * mesh.colors[face[corner] * 3 + channel];
+								}
+								color[channel] = static_cast<unsigned char>(std::clamp(value + 0.5f, 0.0f, 255.0f));
+							}
+						}
+
+						covered[index] = 1;
+					}
+				}
+			}
+
+			progress(static_cast<float>(++chartsDone) / charts.size());
+		}
+	});
+
+	frames.Release();
+
+	if (pool.Cancelled())
+	{
+		mesh.texcoords.clear();
+		mesh.texcoordIndices.clear();
+		return false;
+	}
+
+	Dilate(texture, covered, pool);
+
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "FrameStore.h"
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <functional>
+#include <vector>
+
+//Bakes the scan's color frames into a texture atlas for a mesh
+//Faces are grouped into charts of connected faces facing the same axis direction, each projected flat onto the axis plane
+//Charts are shelf packed into one square atlas and rasterized in parallel, one chart per task so no texel is shared
+//Every texel takes its color from the shot that faces it most directly and sees it in its depth image
+class TextureBaker
+{
+	struct Chart
+	{
+		//Axis the faces are projected along
+		int axis = 0;
+		std::vector<std::uint32_t> faces;
+
+		//Bounds of the projected faces in model units
+		float min[2] = { 0, 0 };
+		float max[2] = { 0, 0 };
+
+		//Texel rectangle in the atlas, padding included
+		int x = 0;
+		int y = 0;
+		int width = 0;
+		int height = 0;
+	};
+
+	//Turn back into the camera space of a shot
+	struct ShotPose
+	{
+		const ShotGrid* grid = nullptr;
+		float sine = 0;
+		float cosine = 1;
+	};
+
+	//Connected faces with the same dominant normal direction
+	void BuildCharts(const IndexedMesh& mesh, std::vector<Chart>& charts) const;
+
+	//Shelf packs the charts at scale texels per unit into a size x size atlas, false if they do not fit
+	bool Pack(std::vector<Chart>& charts, double scale, int size) const;
+
+	//Position of a vertex in the atlas in texels
+	void TexelPosition(const Chart& chart, const float* vertex, double scale, float* texel) const;
+
+	//Color of a surface point from the best facing shot that sees it, false if none does
+	bool SampleShots(const float* position, const float* normal, const std::vector<ShotPose>& poses,
+		FrameStore& frames, unsigned char* color) const;
+
+	//Grows the covered texels into the gutters so filtering at chart borders does not pick up the background
+	void Dilate(TextureImage& texture, std::vector<char>& covered, ThreadPool& pool) const;
+
+public:
+
+	//Width and height of the square atlas
+	int textureSize = 2048;
+
+	//Largest atlas tried, the size doubles while the charts' padding alone does not fit
+	int maxTextureSize = 8192;
+
+	//Texels between charts
+	int padding = 2;
+
+	//A shot sees a point when the point is at most this far (meters) behind the depth it measured
+	float visibilityTolerance = 0.01f;
+
+	//Smallest cosine between the surface normal and the view direction a shot may be used at
+	float minFacing = 0.1f;
+
+	//Fills mesh.texcoords and texture, texels no shot sees get the vertex colors or gray
+	//texture.width is the atlas size used, textureSize or larger when the charts needed it
+	//Returns false if cancelled or the charts do not fit even the largest atlas
+	bool Bake(IndexedMesh& mesh, const std::vector<ShotGrid>& grids, FrameStore& frames, ThreadPool& pool,
+		TextureImage& texture, const std::function<void(float)>& progress) const;
+};
@@ -0,0 +1,145 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	SetThreadCount(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	StopWorkers();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(taskMutex);
+			taskCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+			if (stopping && tasks.empty())
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+
+		task();
+	}
+}
+
+void ThreadPool::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(taskMutex);
+		stopping = true;
+	}
+	taskCondition.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+
+	workers.clear();
+	stopping = false;
+}
+
+void ThreadPool::SetThreadCount(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	if (threadCount == GetThreadCount())
+		return;
+
+	StopWorkers();
+
+	//The thread calling ParallelFor works too
+	for (int i = 1; i < threadCount; ++i)
+		workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+void ThreadPool::ParallelFor(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)>& func)
+{
+	if (count == 0)
+		return;
+
+	grain = std::max<std::size_t>(grain, 1);
+	const std::size_t chunks = ChunkCount(count, grain);
+
+	if (chunks == 1 || workers.empty())
+	{
+		for (std::size_t begin = 0; begin < count && !Cancelled(); begin += grain)
+			func(begin, std::min(begin + grain, count));
+		return;
+	}
+
+	//Shared with the queued tasks, a task may only start after every chunk is done
+	struct Job
+	{
+		std::atomic<std::size_t> nextChunk{ 0 };
+		std::atomic<std::size_t> doneChunks{ 0 };
+		std::mutex doneMutex;
+		std::condition_variable doneCondition;
+
+		//First exception thrown by a chunk, the remaining chunks are skipped and it is rethrown to the caller
+		std::atomic<bool> failed{ false };
+		std::exception_ptr error;
+	};
+
+	auto job = std::make_shared<Job>();
+
+	auto work = [this, job, &func, count, grain, chunks]()
+	{
+		std::size_t chunk;
+		while ((chunk = job->nextChunk++) < chunks)
+		{
+			//Cancelled and failed chunks still count as done so the caller returns
+			const std::size_t begin = chunk * grain;
+			if (!Cancelled() && !job->failed)
+			{
+				try
+				{
+					func(begin, std::min(begin + grain, count));
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(job->doneMutex);
+					if (!job->error)
+						job->error = std::current_exception();
+					job->failed = true;
+				}
+			}
+
+			if (++job->doneChunks == chunks)
+			{
+				std::lock_guard<std::mutex> lock(job->doneMutex);
+				job->doneCondition.notify_all();
+			}
+		}
+	};
+
+	const std::size_t helpers = std::min(workers.size(), chunks - 1);
+	{
+		std::lock_guard<std::mutex> lock(taskMutex);
+		for (std::size_t i = 0; i < helpers; ++i)
+			tasks.push(work);
+	}
+	taskCondition.notify_all();
+
+	//Work on this thread as well, also keeps nested calls from dead locking
+	work();
+
+	std::unique_lock<std::mutex> lock(job->doneMutex);
+	job->doneCondition.wait(lock, [&job, chunks] { return job->doneChunks == chunks; });
+
+	//Every chunk is done, no task refers to func anymore
+	if (job->error)
+		std::rethrow_exception(job->error);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+//Points handled per chunk by the point processing stages
+#define PARALLEL_GRAIN 4096
+
+//Worker threads used by the point processing stages
+class ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+
+	std::mutex taskMutex;
+	std::condition_variable taskCondition;
+	bool stopping = false;
+
+	//Set by the owner to stop the remaining chunks of every ParallelFor
+	const std::atomic<bool>* cancelFlag = nullptr;
+
+	void WorkerLoop();
+	void StopWorkers();
+
+public:
+
+	//0 = one thread per core
+	explicit ThreadPool(int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	//Restarts the workers with a new thread count, 0 = one thread per core
+	void SetThreadCount(int threadCount);
+
+	//Number of threads working on a ParallelFor, the calling thread included
+	int GetThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+	//Calls func(begin, end) for every chunk of [0, count) and waits for all of them
+	//Chunks only depend on grain, never on the thread count, so results written per chunk are deterministic
+	//If a chunk throws, the chunks not yet started are skipped and the first exception is rethrown once all are done
+	void ParallelFor(std::size_t count, std::size_t grain, const std::function<void(std::size_t, std::size_t)>& func);
+
+	//Chunks that have not started are skipped once flag is set, nullptr disables cancellation
+	void SetCancelFlag(const std::atomic<bool>* flag) { cancelFlag = flag; }
+
+	bool Cancelled() const { return cancelFlag && cancelFlag->load(); }
+
+	//Number of chunks ParallelFor splits count into, used to size per chunk results
+	static std::size_t ChunkCount(std::size_t count, std::size_t grain) { return grain == 0 ? 0 : (count + grain - 1) / grain; }
+};
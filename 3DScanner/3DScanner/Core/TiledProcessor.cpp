@@ -0,0 +1,272 @@
+#include "TiledProcessor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+//Position, color, normal and shot of a point on disk
+#define TILE_RECORD_SIZE (sizeof(double) * 6 + 3 + sizeof(int))
+
+//Most bytes buffered per tile before they are appended to its file
+#define TILE_FLUSH_SIZE (1 << 20)
+
+TiledProcessor::TiledProcessor(float tileSize, float haloSize, std::size_t memoryBudget, float alignment) :
+	tileSize(tileSize), haloSize(std::min(haloSize, tileSize)), alignment(alignment), memoryBudget(memoryBudget)
+{
+	std::error_code error;
+	directory = std::filesystem::temp_directory_path(error) / "3DScannerTiles";
+}
+
+TiledProcessor::~TiledProcessor()
+{
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+}
+
+std::filesystem::path TiledProcessor::TilePath(std::size_t tile) const
+{
+	return directory / ("tile" + std::to_string(tile) + ".bin");
+}
+
+bool TiledProcessor::FlushTile(std::size_t tile)
+{
+	Tile& current = tiles[tile];
+
+	if (current.buffer.empty())
+		return true;
+
+	std::ofstream file(TilePath(tile), std::ios::binary | std::ios::app);
+	file.write(reinterpret_cast<const char*>(current.buffer.data()), current.buffer.size());
+
+	current.buffer.clear();
+	return file.good();
+}
+
+int TiledProcessor::TileCoordinate(double value, int axis) const
+{
+	const int coordinate = static_cast<int>(std::floor((value - minCorner[axis]) / tileSize));
+	return std::clamp(coordinate, 0, tileCount[axis] - 1);
+}
+
+bool TiledProcessor::ReadTile(std::size_t tile, PointModel& model) const
+{
+	std::ifstream file(TilePath(tile), std::ios::binary);
+	std::vector<unsigned char> data(tiles[tile].pointCount * TILE_RECORD_SIZE);
+
+	if (!file.read(reinterpret_cast<char*>(data.data()), data.size()))
+		return false;
+
+	model.points.resize(tiles[tile].pointCount);
+
+	for (std::size_t i = 0; i < tiles[tile].pointCount; ++i)
+	{
+		const unsigned char* record = &data[i * TILE_RECORD_SIZE];
+
+		double values[6];
+		std::memcpy(values, record, sizeof(values));
+
+		PointWithData& point = model.points[i];
+		std::get<0>(point) = Point(values[0], values[1], values[2]);
+		std::get<1>(point) = { record[sizeof(values)], record[sizeof(values) + 1], record[sizeof(values) + 2] };
+		std::get<2>(point) = Vector(values[3], values[4], values[5]);
+		std::memcpy(&std::get<3>(point), record + sizeof(values) + 3, sizeof(int));
+	}
+
+	return true;
+}
+
+bool TiledProcessor::Partition(PointModel& model)
+{
+	if (model.points.empty() || tileSize <= 0)
+		return false;
+
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+	std::filesystem::create_directories(directory, error);
+
+	if (error)
+		return false;
+
+	//Bounding box of the cloud
+	double minValue[3] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+	double maxValue[3] = { std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+
+	for (const auto& point : model.points)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			minValue[axis] = std::min(minValue[axis], std::get<0>(point)[axis]);
+			maxValue[axis] = std::max(maxValue[axis], std::get<0>(point)[axis]);
+		}
+	}
+
+	if (alignment > 0)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+			minValue[axis] = std::floor(minValue[axis] / alignment) * alignment;
+	}
+
+	minCorner = Point(minValue[0], minValue[1], minValue[2]);
+
+	for (int axis = 0; axis < 3; ++axis)
+		tileCount[axis] = std::max(1, static_cast<int>(std::ceil((maxValue[axis] - minValue[axis]) / tileSize)));
+
+	tiles.assign(static_cast<std::size_t>(tileCount[0]) * tileCount[1] * tileCount[2], Tile());
+
+	//Fewer, larger writes when the budget allows, at least one record per write
+	flushSize = std::clamp<std::size_t>(memoryBudget / tiles.size(), TILE_RECORD_SIZE, TILE_FLUSH_SIZE);
+
+	//The owning tile gets the point as it is, its neighbors get a copy marked as halo
+	unsigned char record[TILE_RECORD_SIZE];
+	unsigned char haloRecord[TILE_RECORD_SIZE];
+
+	for (const auto& point : model.points)
+	{
+		const Point& position = std::get<0>(point);
+		const Vector& normal = std::get<2>(point);
+		const Color& color = std::get<1>(point);
+
+		PointWithData halo = point;
+		MarkHaloPoint(halo);
+
+		const double values[6] = { position.x(), position.y(), position.z(), normal.x(), normal.y(), normal.z() };
+		std::memcpy(record, values, sizeof(values));
+		std::memcpy(record + sizeof(values), color.data(), 3);
+		std::memcpy(record + sizeof(values) + 3, &std::get<3>(point), sizeof(int));
+
+		std::memcpy(haloRecord, record, TILE_RECORD_SIZE);
+		std::memcpy(haloRecord + sizeof(values) + 3, &std::get<3>(halo), sizeof(int));
+
+		//The owning tile plus every neighbor whose halo reaches this point
+		int owner[3];
+		int low[3];
+		int high[3];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			owner[axis] = TileCoordinate(position[axis], axis);
+			const double local = position[axis] - (minCorner[axis] + owner[axis] * tileSize);
+
+			low[axis] = (local < haloSize && owner[axis] > 0) ? owner[axis] - 1 : owner[axis];
+			high[axis] = (local > tileSize - haloSize && owner[axis] < tileCount[axis] - 1) ? owner[axis] + 1 : owner[axis];
+		}
+
+		for (int z = low[2]; z <= high[2]; ++z)
+		{
+			for (int y = low[1]; y <= high[1]; ++y)
+			{
+				for (int x = low[0]; x <= high[0]; ++x)
+				{
+					const std::size_t tile = (static_cast<std::size_t>(z) * tileCount[1] + y) * tileCount[0] + x;
+					const bool owned = x == owner[0] && y == owner[1] && z == owner[2];
+					const unsigned char* data = owned ? record : haloRecord;
+
+					tiles[tile].buffer.insert(tiles[tile].buffer.end(), data, data + TILE_RECORD_SIZE);
+					++tiles[tile].pointCount;
+
+					if (tiles[tile].buffer.size() >= flushSize && !FlushTile(tile))
+						return false;
+				}
+			}
+		}
+	}
+
+	for (std::size_t tile = 0; tile < tiles.size(); ++tile)
+	{
+		if (!FlushTile(tile))
+			return false;
+
+		tiles[tile].buffer.shrink_to_fit();
+	}
+
+	//The points only live on disk now
+	model.points.clear();
+	model.points.shrink_to_fit();
+
+	return true;
+}
+
+bool TiledProcessor::Process(PointModel& model, ThreadPool& pool,
+	const std::function<void(PointModel&)>& processTile,
+	const std::function<void(std::size_t, std::size_t)>& progress)
+{
+	std::mutex budgetMutex;
+	std::condition_variable budgetCondition;
+	std::size_t budgetUsed = 0;
+	std::size_t finished = 0;
+	std::atomic<bool> failed{ false };
+
+	std::vector<PointModel> results(tiles.size());
+
+	pool.ParallelFor(tiles.size(), 1, [&](std::size_t begin, std::size_t end)
+	{
+		for (std::size_t tile = begin; tile < end; ++tile)
+		{
+			//Loaded points plus the copies and neighbor lists the stages make of them
+			const std::size_t bytes = tiles[tile].pointCount * sizeof(PointWithData) * 4;
+
+			if (tiles[tile].pointCount > 0 && !failed)
+			{
+				//A tile bigger than the budget still runs, but on its own
+				{
+					std::unique_lock<std::mutex> lock(budgetMutex);
+					budgetCondition.wait(lock, [&] { return budgetUsed == 0 || budgetUsed + bytes <= memoryBudget; });
+					budgetUsed += bytes;
+				}
+
+				PointModel tileModel;
+
+				if (ReadTile(tile, tileModel))
+				{
+					processTile(tileModel);
+
+					//Keep the points this tile owned when it was written, wherever the stages moved them
+					//The halo belongs to the neighbors, so every point is kept by exactly one tile
+					for (auto& point : tileModel.points)
+					{
+						if (!IsHaloPoint(point))
+							results[tile].points.push_back(std::move(point));
+					}
+				}
+				else
+					failed = true;
+
+				std::error_code error;
+				std::filesystem::remove(TilePath(tile), error);
+
+				{
+					std::lock_guard<std::mutex> lock(budgetMutex);
+					budgetUsed -= bytes;
+				}
+				budgetCondition.notify_all();
+			}
+
+			std::lock_guard<std::mutex> lock(budgetMutex);
+			progress(++finished, tiles.size());
+		}
+	});
+
+	if (failed)
+		return false;
+
+	//Stitch in tile order so the output does not depend on which tile finished first
+	std::size_t total = 0;
+	for (const auto& result : results)
+		total += result.points.size();
+
+	model.points.clear();
+	model.points.reserve(total);
+
+	for (auto& result : results)
+	{
+		std::move(result.points.begin(), result.points.end(), std::back_inserter(model.points));
+		result.points = {};
+	}
+
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "ModelData.h"
+#include "ThreadPool.h"
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+//Splits a point cloud into spatial tiles stored on disk, each with a halo of its neighbors' points
+//Tiles are processed in parallel while keeping the loaded points under a memory budget, then stitched back together
+class TiledProcessor
+{
+	struct Tile
+	{
+		std::size_t pointCount = 0;
+		std::vector<unsigned char> buffer;
+	};
+
+	std::filesystem::path directory;
+
+	float tileSize;
+	float haloSize;
+	float alignment;
+	std::size_t memoryBudget;
+
+	//Bytes a tile buffers while partitioning, every tile has a buffer so they share the budget
+	std::size_t flushSize = 0;
+
+	Point minCorner;
+	int tileCount[3] = { 0, 0, 0 };
+	std::vector<Tile> tiles;
+
+	std::filesystem::path TilePath(std::size_t tile) const;
+
+	//Appends the buffered points of a tile to its file
+	bool FlushTile(std::size_t tile);
+
+	//Clamped tile coordinate along an axis
+	int TileCoordinate(double value, int axis) const;
+
+	bool ReadTile(std::size_t tile, PointModel& model) const;
+
+public:
+
+	//Tiles start at a multiple of alignment so they share their borders with a grid of that cell size, 0 = at the cloud's corner
+	//The halo only reaches the neighboring tiles, it is clamped to the tile size
+	TiledProcessor(float tileSize, float haloSize, std::size_t memoryBudget, float alignment = 0);
+	~TiledProcessor();
+
+	//Moves the points into tile files and frees the model
+	bool Partition(PointModel& model);
+
+	//Runs processTile on every tile (halo included) and stitches the points each tile owns back into model
+	//Ownership is decided when the tiles are written, halo points carry the mark of ModelData's MarkHaloPoint
+	//progress is called with the number of finished tiles
+	bool Process(PointModel& model, ThreadPool& pool,
+		const std::function<void(PointModel&)>& processTile,
+		const std::function<void(std::size_t, std::size_t)>& progress);
+
+	std::size_t GetTileCount() const { return tiles.size(); }
+};